@@ -0,0 +1,110 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <fstream>
+#include <string>
+#include "syscall_counter.hpp"
+
+#if defined(__linux__)
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace copy::bench
+{
+
+#if defined(__linux__)
+    namespace
+    {
+        auto sys_enter_tracepoint_id() -> std::optional<uint64_t>
+        {
+            for (const auto * path : {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                                      "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"})
+            {
+                std::ifstream file{path};
+                uint64_t id{0};
+                if (file >> id)
+                {
+                    return id;
+                }
+            }
+            return std::nullopt;
+        }
+    } // namespace
+#endif
+
+    SyscallCounter::SyscallCounter()
+    {
+#if defined(__linux__)
+        const auto id = sys_enter_tracepoint_id();
+        if (! id)
+        {
+            return;
+        }
+
+        perf_event_attr attributes{};
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_TRACEPOINT;
+        attributes.size = sizeof(attributes);
+        attributes.config = *id;
+        attributes.disabled = 1;
+        attributes.inherit = 1;
+        m_event.reset(static_cast<int>(::syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0)));
+#endif
+    }
+
+    void SyscallCounter::start()
+    {
+#if defined(__linux__)
+        if (is_available())
+        {
+            ::ioctl(m_event.get(), PERF_EVENT_IOC_RESET, 0);
+            ::ioctl(m_event.get(), PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    auto SyscallCounter::stop() -> std::optional<size_type>
+    {
+#if defined(__linux__)
+        if (is_available())
+        {
+            ::ioctl(m_event.get(), PERF_EVENT_IOC_DISABLE, 0);
+            size_type count{0};
+            if (::read(m_event.get(), &count, sizeof(count)) == sizeof(count))
+            {
+                return count;
+            }
+        }
+#endif
+        return std::nullopt;
+    }
+
+} // namespace copy::bench
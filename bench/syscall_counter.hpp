@@ -0,0 +1,71 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef SYSCALL_COUNTER_HPP
+#define SYSCALL_COUNTER_HPP
+
+#include <cstdint>
+#include <optional>
+#include "file_descriptor.hpp"
+
+namespace copy::bench
+{
+
+    /**
+     * @brief class that counts the system calls made by this process and the threads it starts.
+     *
+     * The count comes from a perf event on the raw_syscalls:sys_enter tracepoint that child threads
+     * inherit.  Threads add their counts when they exit, so stop() the counter after the copy engine
+     * has joined its workers.  The tracepoint needs tracefs and a permissive perf_event_paranoid (or
+     * CAP_PERFMON); without them the counter is unavailable and reports nothing.
+     */
+    class SyscallCounter
+    {
+    public:
+        using size_type = uint64_t;
+
+        SyscallCounter();
+
+        [[nodiscard]] auto is_available() const -> bool
+        {
+            return m_event.is_valid();
+        }
+
+        void start();
+
+        /**
+         * @return the number of system calls since start(), or nothing if the counter is unavailable.
+         */
+        auto stop() -> std::optional<size_type>;
+
+    private:
+        FileDescriptor m_event{};
+    };
+
+} // namespace copy::bench
+
+#endif // SYSCALL_COUNTER_HPP
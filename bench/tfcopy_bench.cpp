@@ -0,0 +1,409 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "TFFoundation.hpp"
+#include "copy_operation.hpp"
+#include "data_model.hpp"
+#include "syscall_counter.hpp"
+#include "tree_generator.hpp"
+#include "utilities.hpp"
+
+using namespace TF::Foundation;
+using namespace copy;
+using namespace copy::bench;
+
+namespace
+{
+    struct Options
+    {
+        std::string work_directory{"/tmp/tfcopy_bench"};
+        std::string output_path{"tfcopy_bench.json"};
+        std::string label{};
+        std::string shapes{"all"};
+        DataModel::size_type scale{1};
+        DataModel::size_type jobs{std::max<DataModel::size_type>(std::thread::hardware_concurrency(), 1)};
+        // In bytes; zero leaves the size to the buffer pool's tuning.
+        DataModel::size_type buffer_size{0};
+        FileCopier::CacheMode cache_mode{FileCopier::CacheMode::Normal};
+        CopyScheduler::Order copy_order{CopyScheduler::Order::Auto};
+        DataModel::size_type prefetch_files{16};
+        bool use_io_uring{false};
+        bool drop_caches{false};
+        bool keep_trees{false};
+    };
+
+    auto seconds_since(std::chrono::steady_clock::time_point start) -> double
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void drop_caches()
+    {
+        ::sync();
+        std::ofstream file{"/proc/sys/vm/drop_caches"};
+        file << "3" << std::endl;
+        if (! file)
+        {
+            std::cerr << "unable to drop the page cache; results include cached reads" << std::endl;
+        }
+    }
+
+    /**
+     * Copy @e source to @e destination in this process and return the measurements as the inside of
+     * a JSON object.  Runs in a forked child so that the peak RSS belongs to this copy alone.
+     */
+    auto measure_copy(const Options & options, const std::string & source, const std::string & destination)
+        -> std::string
+    {
+        DataModel model{};
+        model.source_path = String{source.c_str()};
+        model.destination_path = String{destination.c_str()};
+        model.copy_jobs = options.jobs;
+        model.use_io_uring = options.use_io_uring;
+        model.buffer_size = options.buffer_size;
+        model.cache_mode = options.cache_mode;
+        model.copy_order = options.copy_order;
+        model.prefetch_files = options.prefetch_files;
+
+        SyscallCounter syscalls{};
+        syscalls.start();
+
+        CopyOperation operation{model};
+        const auto start = std::chrono::steady_clock::now();
+        operation.scan();
+        const auto scan_seconds = seconds_since(start);
+        const auto copied = operation.copy();
+        const auto total_seconds = seconds_since(start);
+
+        const auto syscall_count = syscalls.stop();
+
+        const auto files = static_cast<double>(model.total_files.load());
+        const auto bytes = static_cast<double>(model.total_bytes.load());
+        const auto copy_seconds = total_seconds - scan_seconds;
+
+        char buffer[512]{};
+        std::snprintf(buffer, sizeof(buffer),
+                      "\"ok\":%s,\"files\":%.0f,\"bytes\":%.0f,\"scan_seconds\":%.6f,\"copy_seconds\":%.6f,"
+                      "\"total_seconds\":%.6f,\"files_per_second\":%.1f,\"mb_per_second\":%.2f,",
+                      copied ? "true" : "false", files, bytes, scan_seconds, copy_seconds, total_seconds,
+                      files / total_seconds, bytes / (1024 * 1024) / total_seconds);
+        std::string result{buffer};
+
+        if (syscall_count && files > 0)
+        {
+            std::snprintf(buffer, sizeof(buffer), "\"syscalls\":%llu,\"syscalls_per_file\":%.2f",
+                          static_cast<unsigned long long>(*syscall_count),
+                          static_cast<double>(*syscall_count) / files);
+            result += buffer;
+        }
+        else
+        {
+            result += "\"syscalls\":null,\"syscalls_per_file\":null";
+        }
+        return result;
+    }
+
+    /**
+     * Run measure_copy() in a child process and add the child's peak RSS to its result.
+     */
+    auto run_in_child(const Options & options, const std::string & source, const std::string & destination)
+        -> std::string
+    {
+        int pipe_descriptors[2]{};
+        if (::pipe(pipe_descriptors) != 0)
+        {
+            return "\"ok\":false,\"error\":\"unable to create a pipe\"";
+        }
+
+        const auto child = ::fork();
+        if (child == 0)
+        {
+            ::close(pipe_descriptors[0]);
+            const auto result = measure_copy(options, source, destination);
+            const auto written = ::write(pipe_descriptors[1], result.data(), result.size());
+            ::_exit(written == static_cast<ssize_t>(result.size()) ? 0 : 1);
+        }
+        ::close(pipe_descriptors[1]);
+        if (child < 0)
+        {
+            ::close(pipe_descriptors[0]);
+            return "\"ok\":false,\"error\":\"unable to fork\"";
+        }
+
+        std::string result{};
+        char buffer[4096]{};
+        ssize_t bytes_read{0};
+        while ((bytes_read = ::read(pipe_descriptors[0], buffer, sizeof(buffer))) > 0)
+        {
+            result.append(buffer, static_cast<size_t>(bytes_read));
+        }
+        ::close(pipe_descriptors[0]);
+
+        int status{0};
+        struct rusage usage
+        {};
+        ::wait4(child, &status, 0, &usage);
+        if (! WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.empty())
+        {
+            return "\"ok\":false,\"error\":\"the benchmark process failed\"";
+        }
+
+        // ru_maxrss is in KiB on Linux and in bytes on macOS.
+#if defined(__APPLE__)
+        const auto peak_rss_kib = usage.ru_maxrss / 1024;
+#else
+        const auto peak_rss_kib = usage.ru_maxrss;
+#endif
+        return result + ",\"peak_rss_kib\":" + std::to_string(peak_rss_kib);
+    }
+
+    auto wants_shape(const Options & options, TreeGenerator::Shape shape) -> bool
+    {
+        if (options.shapes == "all")
+        {
+            return true;
+        }
+        std::stringstream names{options.shapes};
+        std::string name{};
+        while (std::getline(names, name, ','))
+        {
+            if (name == TreeGenerator::name_of(shape))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+} // namespace
+
+int main(int argc, const char ** argv)
+{
+    ArgumentParser parser{};
+    parser.setName("tfcopy_bench");
+    parser.setVersion(DataModel{}.tool_version);
+    parser.setExitOnHelp(true);
+    parser.addArgument({"--work_dir"}, ArgumentType::String, "",
+                       "Directory for the generated trees (default /tmp/tfcopy_bench)", false);
+    parser.addArgument({"-o", "--output"}, ArgumentType::String, "",
+                       "JSON file for the results (default tfcopy_bench.json)", false);
+    parser.addArgument({"--label"}, ArgumentType::String, "", "Label stored with the results, e.g. a commit hash",
+                       false);
+    parser.addArgument({"--shapes"}, ArgumentType::String, "",
+                       "Comma separated trees to run: tiny_files, deep_nesting, huge_files, mixed (default all)",
+                       false);
+    parser.addArgument({"--scale"}, ArgumentType::Int, "", "Multiplier for the size of the generated trees", false);
+    parser.addArgument({"-j", "--jobs"}, ArgumentType::Int, "", "Number of files to copy concurrently", false);
+    parser.addArgument({"--buffer_size"}, ArgumentType::Int, "",
+                       "Read/write buffer size in KiB (default: tuned while copying)", false);
+    parser.addArgument({"--cache_mode"}, ArgumentType::String, "", "Page cache use: normal, drop_behind or direct",
+                       false);
+    parser.addArgument({"--order"}, ArgumentType::String, "", "File order: auto, scan, inode or extent", false);
+    parser.addArgument({"--prefetch"}, ArgumentType::Int, "", "Number of queued files to read ahead (0 disables)",
+                       false);
+    parser.addStoreTrueArgument({"--io_uring"}, "", "Copy small files in batches through io_uring", false);
+    parser.addStoreTrueArgument({"--drop_caches"}, "", "Drop the page cache before every copy (needs root)",
+                                false);
+    parser.addStoreTrueArgument({"--keep_trees"}, "", "Keep the generated source trees for the next run", false);
+
+    if (! parser.parseArgs(argc, argv))
+    {
+        return -1;
+    }
+
+    Options options{};
+    String value{};
+    if (parser.hasValueForArgument("work_dir") && parser.getValueForArgument("work_dir", value))
+    {
+        options.work_directory = value.stlStringInUTF8();
+    }
+    if (parser.hasValueForArgument("output") && parser.getValueForArgument("output", value))
+    {
+        options.output_path = value.stlStringInUTF8();
+    }
+    if (parser.hasValueForArgument("label") && parser.getValueForArgument("label", value))
+    {
+        options.label = value.stlStringInUTF8();
+    }
+    if (parser.hasValueForArgument("shapes") && parser.getValueForArgument("shapes", value))
+    {
+        options.shapes = value.stlStringInUTF8();
+    }
+    if (parser.hasValueForArgument("scale"))
+    {
+        int64_t scale{0};
+        parser.getValueForArgument("scale", scale);
+        if (scale < 1)
+        {
+            std::cout << "--scale must be at least 1" << std::endl;
+            return -1;
+        }
+        options.scale = static_cast<DataModel::size_type>(scale);
+    }
+    if (parser.hasValueForArgument("jobs"))
+    {
+        int64_t jobs{0};
+        parser.getValueForArgument("jobs", jobs);
+        if (jobs < 1)
+        {
+            std::cout << "--jobs must be at least 1" << std::endl;
+            return -1;
+        }
+        options.jobs = static_cast<DataModel::size_type>(jobs);
+    }
+    if (parser.hasValueForArgument("buffer_size"))
+    {
+        int64_t buffer_size{0};
+        parser.getValueForArgument("buffer_size", buffer_size);
+        if (buffer_size < 4 || buffer_size > 1024 * 1024)
+        {
+            std::cout << "--buffer_size must be between 4 and 1048576 KiB" << std::endl;
+            return -1;
+        }
+        options.buffer_size = static_cast<DataModel::size_type>(buffer_size) * 1024;
+    }
+    if (parser.hasValueForArgument("cache_mode") && parser.getValueForArgument("cache_mode", value) &&
+        ! FileCopier::cache_mode_named(value.stlStringInUTF8(), options.cache_mode))
+    {
+        std::cout << "--cache_mode must be normal, drop_behind or direct" << std::endl;
+        return -1;
+    }
+    if (parser.hasValueForArgument("order") && parser.getValueForArgument("order", value) &&
+        ! CopyScheduler::order_named(value.stlStringInUTF8(), options.copy_order))
+    {
+        std::cout << "--order must be auto, scan, inode or extent" << std::endl;
+        return -1;
+    }
+    if (parser.hasValueForArgument("prefetch"))
+    {
+        int64_t prefetch{0};
+        parser.getValueForArgument("prefetch", prefetch);
+        if (prefetch < 0)
+        {
+            std::cout << "--prefetch cannot be negative" << std::endl;
+            return -1;
+        }
+        options.prefetch_files = static_cast<DataModel::size_type>(prefetch);
+    }
+    parser.getValueForArgument("io_uring", options.use_io_uring);
+    parser.getValueForArgument("drop_caches", options.drop_caches);
+    parser.getValueForArgument("keep_trees", options.keep_trees);
+
+    std::error_code error{};
+    std::filesystem::create_directories(options.work_directory, error);
+    if (error)
+    {
+        std::cout << "unable to create " << options.work_directory << ": " << error.message() << std::endl;
+        return -1;
+    }
+
+    if (! SyscallCounter{}.is_available())
+    {
+        std::cerr << "system call counting is unavailable (needs tracefs and perf_event_open)" << std::endl;
+    }
+
+    TreeGenerator generator{options.scale};
+    std::vector<std::string> results{};
+    for (const auto shape : TreeGenerator::all_shapes())
+    {
+        if (! wants_shape(options, shape))
+        {
+            continue;
+        }
+
+        const auto name = TreeGenerator::name_of(shape);
+        const auto source = options.work_directory + "/" + name + "_x" + std::to_string(options.scale);
+        const auto destination = options.work_directory + "/" + name + "_copy";
+        std::filesystem::remove_all(destination, error);
+
+        if (! std::filesystem::exists(source))
+        {
+            std::cout << "generating " << name << "..." << std::endl;
+            try
+            {
+                generator.generate(shape, source);
+            }
+            catch (std::exception & e)
+            {
+                std::cout << "unable to generate " << name << ": " << e.what() << std::endl;
+                std::filesystem::remove_all(source, error);
+                return -1;
+            }
+        }
+
+        if (options.drop_caches)
+        {
+            drop_caches();
+        }
+
+        std::cout << "copying " << name << "..." << std::endl;
+        const auto result = "{\"shape\":\"" + name + "\"," + run_in_child(options, source, destination) + "}";
+        std::cout << result << std::endl;
+        results.push_back(result);
+
+        std::filesystem::remove_all(destination, error);
+        if (! options.keep_trees)
+        {
+            std::filesystem::remove_all(source, error);
+        }
+    }
+
+    std::string label{};
+    append_json_string(label, options.label);
+    std::ofstream output{options.output_path};
+    output << "{\"label\":" << label << ",\"timestamp\":" << std::time(nullptr)
+           << ",\"scale\":" << options.scale << ",\"jobs\":" << options.jobs
+           << ",\"io_uring\":" << (options.use_io_uring ? "true" : "false")
+           << ",\"buffer_size\":" << options.buffer_size << ",\"cache_mode\":\""
+           << FileCopier::cache_mode_name(options.cache_mode) << "\",\"order\":\""
+           << CopyScheduler::order_name(options.copy_order) << "\",\"prefetch\":" << options.prefetch_files
+           << ",\"results\":[";
+    for (size_t index = 0; index < results.size(); index++)
+    {
+        output << (index > 0 ? "," : "") << "\n  " << results[index];
+    }
+    output << "\n]}" << std::endl;
+    if (! output)
+    {
+        std::cout << "unable to write " << options.output_path << std::endl;
+        return -1;
+    }
+
+    std::cout << "results written to " << options.output_path << std::endl;
+    return 0;
+}
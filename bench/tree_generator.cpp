@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tree_generator.hpp"
+#include "file_descriptor.hpp"
+
+namespace copy::bench
+{
+
+    namespace
+    {
+        constexpr TreeGenerator::size_type contents_size{4 * 1024 * 1024};
+        constexpr TreeGenerator::size_type random_seed{0x7466636f7079};
+    } // namespace
+
+    TreeGenerator::TreeGenerator(size_type scale) : m_scale{scale > 0 ? scale : 1}, m_random{random_seed}
+    {
+        m_contents.resize(contents_size);
+        std::uniform_int_distribution<int> byte{0, 255};
+        for (auto & character : m_contents)
+        {
+            character = static_cast<char>(byte(m_random));
+        }
+    }
+
+    auto TreeGenerator::name_of(Shape shape) -> std::string
+    {
+        switch (shape)
+        {
+            case Shape::TinyFiles:
+                return "tiny_files";
+            case Shape::DeepNesting:
+                return "deep_nesting";
+            case Shape::HugeFiles:
+                return "huge_files";
+            case Shape::Mixed:
+                return "mixed";
+        }
+        return "unknown";
+    }
+
+    auto TreeGenerator::all_shapes() -> std::vector<Shape>
+    {
+        return {Shape::TinyFiles, Shape::DeepNesting, Shape::HugeFiles, Shape::Mixed};
+    }
+
+    auto TreeGenerator::generate(Shape shape, const std::string & root) -> Summary
+    {
+        m_random.seed(random_seed);
+        m_summary = Summary{};
+        make_directory(root);
+
+        switch (shape)
+        {
+            case Shape::TinyFiles:
+                generate_tiny_files(root);
+                break;
+            case Shape::DeepNesting:
+                generate_deep_nesting(root);
+                break;
+            case Shape::HugeFiles:
+                generate_huge_files(root);
+                break;
+            case Shape::Mixed:
+                generate_mixed(root);
+                break;
+        }
+        return m_summary;
+    }
+
+    void TreeGenerator::generate_tiny_files(const std::string & root)
+    {
+        // 20,000 files of 0 to 4 KiB per unit of scale, 200 to a directory.
+        std::uniform_int_distribution<size_type> size{0, 4096};
+        for (size_type directory = 0; directory < 100 * m_scale; directory++)
+        {
+            const auto directory_path = root + "/d" + std::to_string(directory);
+            make_directory(directory_path);
+            for (size_type file = 0; file < 200; file++)
+            {
+                write_file(directory_path + "/f" + std::to_string(file), size(m_random));
+            }
+        }
+    }
+
+    void TreeGenerator::generate_deep_nesting(const std::string & root)
+    {
+        // Chains 128 directories deep with a few small files at every level.
+        std::uniform_int_distribution<size_type> size{1, 16 * 1024};
+        for (size_type chain = 0; chain < 4 * m_scale; chain++)
+        {
+            auto directory_path = root + "/c" + std::to_string(chain);
+            for (size_type depth = 0; depth < 128; depth++)
+            {
+                make_directory(directory_path);
+                for (size_type file = 0; file < 8; file++)
+                {
+                    write_file(directory_path + "/f" + std::to_string(file), size(m_random));
+                }
+                directory_path += "/d";
+            }
+        }
+    }
+
+    void TreeGenerator::generate_huge_files(const std::string & root)
+    {
+        // Three files of 256 MiB per unit of scale.
+        for (size_type file = 0; file < 3; file++)
+        {
+            write_file(root + "/huge" + std::to_string(file), m_scale * 256 * 1024 * 1024);
+        }
+    }
+
+    void TreeGenerator::generate_mixed(const std::string & root)
+    {
+        // Sizes follow a log-normal distribution with a median of 16 KiB, which is roughly what home
+        // directories and source trees look like: mostly small files and a long tail of big ones.
+        std::lognormal_distribution<double> size{std::log(16.0 * 1024), 2.0};
+        constexpr double largest_file{256.0 * 1024 * 1024};
+
+        for (size_type file = 0; file < 10'000 * m_scale; file++)
+        {
+            // Spread the files over a tree that fans out by ten, three levels deep.
+            const auto leaf = file % 1000;
+            const auto directory_path = root + "/a" + std::to_string(leaf / 100) + "/b" +
+                                        std::to_string(leaf / 10 % 10) + "/c" + std::to_string(leaf % 10);
+            if (file < 1000)
+            {
+                make_directory(root + "/a" + std::to_string(leaf / 100));
+                make_directory(root + "/a" + std::to_string(leaf / 100) + "/b" + std::to_string(leaf / 10 % 10));
+                make_directory(directory_path);
+            }
+            write_file(directory_path + "/f" + std::to_string(file),
+                       static_cast<size_type>(std::min(size(m_random), largest_file)));
+        }
+    }
+
+    void TreeGenerator::make_directory(const std::string & path)
+    {
+        if (::mkdir(path.c_str(), 0755) != 0)
+        {
+            if (errno == EEXIST)
+            {
+                return;
+            }
+            throw std::system_error(errno, std::generic_category(), "unable to create " + path);
+        }
+        m_summary.directories += 1;
+    }
+
+    void TreeGenerator::write_file(const std::string & path, size_type size)
+    {
+        FileDescriptor file{::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+        if (! file.is_valid())
+        {
+            throw std::system_error(errno, std::generic_category(), "unable to create " + path);
+        }
+
+        // Start each file at a different place in the buffer so files do not share contents.
+        auto offset = static_cast<size_type>(m_random() % contents_size);
+        auto remaining = size;
+        while (remaining > 0)
+        {
+            const auto length = std::min(remaining, contents_size - offset);
+            const auto written = ::write(file.get(), m_contents.data() + offset, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "unable to write " + path);
+            }
+            remaining -= static_cast<size_type>(written);
+            offset = (offset + static_cast<size_type>(written)) % contents_size;
+        }
+
+        m_summary.files += 1;
+        m_summary.bytes += size;
+    }
+
+} // namespace copy::bench
@@ -0,0 +1,102 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef TREE_GENERATOR_HPP
+#define TREE_GENERATOR_HPP
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace copy::bench
+{
+
+    /**
+     * @brief class that writes synthetic source trees for the benchmark.
+     *
+     * Every generator is deterministic: the same shape and scale always produce the same sizes and
+     * layout, so results from different commits compare like with like.  File contents come from one
+     * random buffer so they do not compress or deduplicate to nothing.
+     */
+    class TreeGenerator
+    {
+    public:
+        using size_type = uint64_t;
+
+        enum class Shape
+        {
+            TinyFiles,
+            DeepNesting,
+            HugeFiles,
+            Mixed
+        };
+
+        struct Summary
+        {
+            size_type files{0};
+            size_type directories{0};
+            size_type bytes{0};
+        };
+
+        /**
+         * @param scale multiplies the number of files (or, for HugeFiles, their size).
+         */
+        explicit TreeGenerator(size_type scale);
+
+        [[nodiscard]] static auto name_of(Shape shape) -> std::string;
+
+        [[nodiscard]] static auto all_shapes() -> std::vector<Shape>;
+
+        /**
+         * @brief method to write a tree of @e shape below @e root, which must not exist yet.
+         * @throw std::system_error if a file or directory cannot be written.
+         */
+        auto generate(Shape shape, const std::string & root) -> Summary;
+
+    private:
+        size_type m_scale{1};
+        std::mt19937_64 m_random{};
+        std::vector<char> m_contents{};
+        Summary m_summary{};
+
+        void generate_tiny_files(const std::string & root);
+
+        void generate_deep_nesting(const std::string & root);
+
+        void generate_huge_files(const std::string & root);
+
+        void generate_mixed(const std::string & root);
+
+        void make_directory(const std::string & path);
+
+        void write_file(const std::string & path, size_type size);
+    };
+
+} // namespace copy::bench
+
+#endif // TREE_GENERATOR_HPP
@@ -0,0 +1,239 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <new>
+#include "buffer_pool.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        // A size is measured over at least this much data, or sixteen buffers, whichever is more.
+        constexpr BufferPool::size_type minimum_window_bytes{64 * 1024 * 1024};
+        constexpr BufferPool::size_type buffers_per_window{16};
+
+        // A neighbouring size has to beat the current one by this much to be kept.
+        constexpr double improvement_needed{1.05};
+
+        // After a failed try, wait this many windows at most before the next one.
+        constexpr BufferPool::size_type maximum_probe_backoff{16};
+
+        auto round_to_pages(BufferPool::size_type size) -> BufferPool::size_type
+        {
+            return std::max<BufferPool::size_type>(
+                (size + BufferPool::page_size - 1) / BufferPool::page_size * BufferPool::page_size,
+                BufferPool::page_size);
+        }
+    } // namespace
+
+    BufferPool::Buffer::Buffer(Buffer && other) noexcept :
+        m_pool{other.m_pool}, m_data{other.m_data}, m_size{other.m_size}
+    {
+        other.m_pool = nullptr;
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+
+    auto BufferPool::Buffer::operator=(Buffer && other) noexcept -> Buffer &
+    {
+        if (this != &other)
+        {
+            release();
+            std::swap(m_pool, other.m_pool);
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+        }
+        return *this;
+    }
+
+    BufferPool::Buffer::~Buffer()
+    {
+        release();
+    }
+
+    void BufferPool::Buffer::release()
+    {
+        if (m_pool && m_data)
+        {
+            m_pool->give_back(m_data, m_size);
+        }
+        m_pool = nullptr;
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    BufferPool::~BufferPool()
+    {
+        for (auto & [size, buffers] : m_free)
+        {
+            for (auto * buffer : buffers)
+            {
+                std::free(buffer);
+            }
+        }
+    }
+
+    void BufferPool::seed(size_type block_size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_seeded || m_fixed)
+        {
+            return;
+        }
+        m_seeded = true;
+
+        // Sixteen blocks per call keeps the system call count down without outgrowing the caches.
+        m_size = std::clamp(std::bit_ceil(std::max<size_type>(block_size, 1) * 16), minimum_size, maximum_size);
+        m_settled_size = m_size;
+    }
+
+    void BufferPool::set_fixed_size(size_type size)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fixed = size > 0;
+        if (m_fixed)
+        {
+            m_size = round_to_pages(size);
+            m_settled_size = m_size;
+        }
+    }
+
+    auto BufferPool::current_size() const -> size_type
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+
+    auto BufferPool::acquire(size_type file_size) -> Buffer
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // Smaller files get a smaller buffer, rounded to a power of two so released buffers fit the
+        // next file of a similar size.
+        auto size = m_size;
+        if (file_size < size)
+        {
+            size = std::min(size, std::bit_ceil(round_to_pages(file_size)));
+        }
+
+        if (auto found = m_free.find(size); found != m_free.end() && ! found->second.empty())
+        {
+            auto * data = found->second.back();
+            found->second.pop_back();
+            m_cached_bytes -= size;
+            return Buffer{this, data, size};
+        }
+        lock.unlock();
+
+        auto * data = static_cast<char *>(std::aligned_alloc(page_size, size));
+        if (data == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return Buffer{this, data, size};
+    }
+
+    void BufferPool::record(size_type buffer_size, size_type bytes, duration_type elapsed)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_fixed || buffer_size != m_size || bytes < buffer_size)
+        {
+            return;
+        }
+
+        m_window_bytes += bytes;
+        m_window_time += elapsed;
+        if (m_window_bytes < std::max(minimum_window_bytes, m_size * buffers_per_window))
+        {
+            return;
+        }
+
+        const auto seconds = std::chrono::duration<double>(m_window_time).count();
+        const auto throughput = seconds > 0 ? static_cast<double>(m_window_bytes) / seconds : 0.0;
+        m_window_bytes = 0;
+        m_window_time = {};
+        finish_window(throughput);
+    }
+
+    void BufferPool::finish_window(double throughput)
+    {
+        if (! m_probing)
+        {
+            // Measure the settled size again every window, since the load on the devices changes.
+            m_settled_throughput = throughput;
+            if (m_windows_until_probe > 0)
+            {
+                m_windows_until_probe--;
+                return;
+            }
+
+            if ((m_probe_larger && m_settled_size * 2 > maximum_size) ||
+                (! m_probe_larger && m_settled_size / 2 < minimum_size))
+            {
+                m_probe_larger = ! m_probe_larger;
+            }
+            m_size = m_probe_larger ? m_settled_size * 2 : m_settled_size / 2;
+            m_probing = true;
+            return;
+        }
+
+        m_probing = false;
+        if (throughput > m_settled_throughput * improvement_needed)
+        {
+            // Better; settle here and keep going the same way.
+            m_settled_size = m_size;
+            m_settled_throughput = throughput;
+            m_probe_backoff = 1;
+            return;
+        }
+
+        // No better; go back, and try the other way after a pause that grows while nothing helps.
+        m_size = m_settled_size;
+        m_probe_larger = ! m_probe_larger;
+        m_windows_until_probe = m_probe_backoff;
+        m_probe_backoff = std::min(m_probe_backoff * 2, maximum_probe_backoff);
+    }
+
+    void BufferPool::give_back(char * data, size_type size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_cached_bytes + size <= maximum_cached_bytes)
+            {
+                m_free[size].push_back(data);
+                m_cached_bytes += size;
+                return;
+            }
+        }
+        std::free(data);
+    }
+
+} // namespace copy
@@ -0,0 +1,168 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace copy
+{
+
+    /**
+     * @brief class that hands out page-aligned I/O buffers, keeps released ones for reuse, and picks
+     * the size the copy loops should use.
+     *
+     * The starting size comes from the st_blksize of the source and destination file systems, which
+     * is 4 KiB on local disks and the transfer size on most network file systems.  After that the
+     * pool tunes the size from the throughput the copy loops report through record(): it tries the
+     * next larger or smaller power of two, keeps it if it is at least 5% faster, and otherwise goes
+     * back and waits a while before trying again.  set_fixed_size() turns the tuning off.
+     *
+     * Buffers are aligned to page_size, so they also work for O_DIRECT.
+     */
+    class BufferPool
+    {
+    public:
+        using size_type = uint64_t;
+        using clock_type = std::chrono::steady_clock;
+        using duration_type = clock_type::duration;
+
+        static constexpr size_type page_size{4096};
+        static constexpr size_type minimum_size{64 * 1024};
+        static constexpr size_type maximum_size{16 * 1024 * 1024};
+
+        /**
+         * @brief class that owns a buffer from the pool and gives it back when destroyed.
+         */
+        class Buffer
+        {
+        public:
+            Buffer() = default;
+
+            Buffer(const Buffer &) = delete;
+
+            Buffer & operator=(const Buffer &) = delete;
+
+            Buffer(Buffer && other) noexcept;
+
+            Buffer & operator=(Buffer && other) noexcept;
+
+            ~Buffer();
+
+            [[nodiscard]] auto data() const -> char *
+            {
+                return m_data;
+            }
+
+            [[nodiscard]] auto size() const -> size_type
+            {
+                return m_size;
+            }
+
+        private:
+            BufferPool * m_pool{nullptr};
+            char * m_data{nullptr};
+            size_type m_size{0};
+
+            Buffer(BufferPool * pool, char * data, size_type size) : m_pool{pool}, m_data{data}, m_size{size} {}
+
+            void release();
+
+            friend class BufferPool;
+        };
+
+        BufferPool() = default;
+
+        BufferPool(const BufferPool &) = delete;
+
+        BufferPool & operator=(const BufferPool &) = delete;
+
+        ~BufferPool();
+
+        /**
+         * @brief method to set the starting size from the file systems' preferred I/O size.  The
+         * first call wins; later ones are ignored.
+         */
+        void seed(size_type block_size);
+
+        /**
+         * @brief method to use @e size for every buffer and stop tuning.  Zero turns tuning back on.
+         */
+        void set_fixed_size(size_type size);
+
+        /**
+         * @return the size the copy loops should use now.
+         */
+        [[nodiscard]] auto current_size() const -> size_type;
+
+        /**
+         * @brief method to get a buffer for copying a file of @e file_size bytes: current_size(), or
+         * less for a smaller file.  Throws std::bad_alloc if memory runs out.
+         */
+        auto acquire(size_type file_size) -> Buffer;
+
+        /**
+         * @brief method to report that a buffer of @e buffer_size moved @e bytes in @e elapsed.  Only
+         * full buffers of the current size count toward tuning.
+         */
+        void record(size_type buffer_size, size_type bytes, duration_type elapsed);
+
+    private:
+        // Released buffers are kept up to this many bytes in all.
+        static constexpr size_type maximum_cached_bytes{256 * 1024 * 1024};
+
+        mutable std::mutex m_mutex{};
+        std::map<size_type, std::vector<char *>> m_free{};
+        size_type m_cached_bytes{0};
+
+        bool m_seeded{false};
+        bool m_fixed{false};
+        size_type m_size{minimum_size};
+
+        // Tuning state: the size in use and its throughput, and the size being tried instead.
+        size_type m_settled_size{minimum_size};
+        double m_settled_throughput{0};
+        bool m_probing{false};
+        bool m_probe_larger{true};
+        size_type m_windows_until_probe{0};
+        size_type m_probe_backoff{1};
+        size_type m_window_bytes{0};
+        duration_type m_window_time{};
+
+        void give_back(char * data, size_type size);
+
+        void finish_window(double throughput);
+    };
+
+} // namespace copy
+
+#endif // BUFFER_POOL_HPP
@@ -0,0 +1,308 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <new>
+#include <xxhash.h>
+#include "content_hash.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        /**
+         * @brief SHA-256 as specified in FIPS 180-4.  Only --verify uses it, so a plain portable
+         * implementation is enough.
+         */
+        class Sha256
+        {
+        public:
+            Sha256()
+            {
+                reset();
+            }
+
+            void reset()
+            {
+                m_hash = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                          0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+                m_length = 0;
+                m_block_used = 0;
+            }
+
+            void update(const uint8_t * data, size_t length)
+            {
+                m_length += length;
+
+                if (m_block_used > 0)
+                {
+                    const auto taken = std::min(length, m_block.size() - m_block_used);
+                    std::memcpy(m_block.data() + m_block_used, data, taken);
+                    m_block_used += taken;
+                    data += taken;
+                    length -= taken;
+                    if (m_block_used < m_block.size())
+                    {
+                        return;
+                    }
+                    compress(m_block.data());
+                    m_block_used = 0;
+                }
+
+                for (; length >= m_block.size(); data += m_block.size(), length -= m_block.size())
+                {
+                    compress(data);
+                }
+
+                std::memcpy(m_block.data(), data, length);
+                m_block_used = length;
+            }
+
+            void finish(uint8_t * output) const
+            {
+                auto copy = *this;
+                const auto bit_length = m_length * 8;
+
+                constexpr uint8_t end_marker{0x80};
+                copy.append_padding(&end_marker, 1);
+                constexpr uint8_t zero{0};
+                while (copy.m_block_used != m_block.size() - 8)
+                {
+                    copy.append_padding(&zero, 1);
+                }
+
+                uint8_t length_bytes[8]{};
+                for (size_t i = 0; i < 8; i++)
+                {
+                    length_bytes[i] = static_cast<uint8_t>(bit_length >> (56 - i * 8));
+                }
+                copy.append_padding(length_bytes, sizeof(length_bytes));
+
+                for (size_t i = 0; i < copy.m_hash.size(); i++)
+                {
+                    for (size_t j = 0; j < 4; j++)
+                    {
+                        output[i * 4 + j] = static_cast<uint8_t>(copy.m_hash[i] >> (24 - j * 8));
+                    }
+                }
+            }
+
+        private:
+            std::array<uint32_t, 8> m_hash{};
+            std::array<uint8_t, 64> m_block{};
+            size_t m_block_used{0};
+            uint64_t m_length{0};
+
+            // Like update(), but without counting the bytes toward the message length.
+            void append_padding(const uint8_t * data, size_t length)
+            {
+                const auto saved_length = m_length;
+                update(data, length);
+                m_length = saved_length;
+            }
+
+            static auto rotate_right(uint32_t value, int count) -> uint32_t
+            {
+                return (value >> count) | (value << (32 - count));
+            }
+
+            void compress(const uint8_t * block)
+            {
+                static constexpr std::array<uint32_t, 64> round_constants{
+                    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+                std::array<uint32_t, 64> schedule{};
+                for (size_t i = 0; i < 16; i++)
+                {
+                    schedule[i] = static_cast<uint32_t>(block[i * 4]) << 24 |
+                                  static_cast<uint32_t>(block[i * 4 + 1]) << 16 |
+                                  static_cast<uint32_t>(block[i * 4 + 2]) << 8 |
+                                  static_cast<uint32_t>(block[i * 4 + 3]);
+                }
+                for (size_t i = 16; i < 64; i++)
+                {
+                    const auto s0 = rotate_right(schedule[i - 15], 7) ^ rotate_right(schedule[i - 15], 18) ^
+                                    (schedule[i - 15] >> 3);
+                    const auto s1 = rotate_right(schedule[i - 2], 17) ^ rotate_right(schedule[i - 2], 19) ^
+                                    (schedule[i - 2] >> 10);
+                    schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+                }
+
+                auto [a, b, c, d, e, f, g, h] = m_hash;
+                for (size_t i = 0; i < 64; i++)
+                {
+                    const auto s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+                    const auto choice = (e & f) ^ (~e & g);
+                    const auto temp1 = h + s1 + choice + round_constants[i] + schedule[i];
+                    const auto s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+                    const auto majority = (a & b) ^ (a & c) ^ (b & c);
+                    const auto temp2 = s0 + majority;
+                    h = g;
+                    g = f;
+                    f = e;
+                    e = d + temp1;
+                    d = c;
+                    c = b;
+                    b = a;
+                    a = temp1 + temp2;
+                }
+
+                m_hash[0] += a;
+                m_hash[1] += b;
+                m_hash[2] += c;
+                m_hash[3] += d;
+                m_hash[4] += e;
+                m_hash[5] += f;
+                m_hash[6] += g;
+                m_hash[7] += h;
+            }
+        };
+    } // namespace
+
+    struct ContentHasher::State
+    {
+        std::unique_ptr<XXH3_state_t, XXH_errorcode (*)(XXH3_state_t *)> xxh3{nullptr, XXH3_freeState};
+        Sha256 sha256{};
+    };
+
+    auto ContentHasher::Digest::to_string() const -> std::string
+    {
+        static constexpr char digits[]{"0123456789abcdef"};
+        std::string result{};
+        result.reserve(length * 2);
+        for (size_t i = 0; i < length; i++)
+        {
+            result.push_back(digits[bytes[i] >> 4]);
+            result.push_back(digits[bytes[i] & 0x0f]);
+        }
+        return result;
+    }
+
+    ContentHasher::ContentHasher(Algorithm algorithm) : m_algorithm{algorithm}, m_state{std::make_unique<State>()}
+    {
+        if (m_algorithm == Algorithm::XXH3)
+        {
+            m_state->xxh3.reset(XXH3_createState());
+            if (! m_state->xxh3)
+            {
+                throw std::bad_alloc();
+            }
+        }
+        reset();
+    }
+
+    ContentHasher::~ContentHasher() = default;
+
+    void ContentHasher::update(const void * data, size_t length)
+    {
+        switch (m_algorithm)
+        {
+            case Algorithm::XXH3:
+                XXH3_128bits_update(m_state->xxh3.get(), data, length);
+                break;
+            case Algorithm::SHA256:
+                m_state->sha256.update(static_cast<const uint8_t *>(data), length);
+                break;
+        }
+    }
+
+    auto ContentHasher::digest() const -> Digest
+    {
+        Digest result{};
+        switch (m_algorithm)
+        {
+            case Algorithm::XXH3:
+            {
+                XXH128_canonical_t canonical{};
+                XXH128_canonicalFromHash(&canonical, XXH3_128bits_digest(m_state->xxh3.get()));
+                static_assert(sizeof(canonical.digest) <= sizeof(result.bytes));
+                std::memcpy(result.bytes.data(), canonical.digest, sizeof(canonical.digest));
+                result.length = sizeof(canonical.digest);
+                break;
+            }
+            case Algorithm::SHA256:
+                m_state->sha256.finish(result.bytes.data());
+                result.length = 32;
+                break;
+        }
+        return result;
+    }
+
+    void ContentHasher::reset()
+    {
+        switch (m_algorithm)
+        {
+            case Algorithm::XXH3:
+                XXH3_128bits_reset(m_state->xxh3.get());
+                break;
+            case Algorithm::SHA256:
+                m_state->sha256.reset();
+                break;
+        }
+    }
+
+    auto ContentHasher::name_of(Algorithm algorithm) -> const char *
+    {
+        switch (algorithm)
+        {
+            case Algorithm::XXH3:
+                return "xxh3";
+            case Algorithm::SHA256:
+                return "sha256";
+        }
+        return "unknown";
+    }
+
+    auto ContentHasher::algorithm_named(const std::string & name, Algorithm & algorithm) -> bool
+    {
+        std::string lower{name};
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char character) {
+            return static_cast<char>(std::tolower(character));
+        });
+
+        for (auto candidate : {Algorithm::XXH3, Algorithm::SHA256})
+        {
+            if (lower == name_of(candidate))
+            {
+                algorithm = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // namespace copy
@@ -0,0 +1,109 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef CONTENT_HASH_HPP
+#define CONTENT_HASH_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace copy
+{
+
+    /**
+     * @brief class that hashes a stream of bytes for --verify.
+     *
+     * XXH3 is the default: its 128 bit variant runs at memory speed on SIMD hardware, so hashing
+     * the data while it is in a copy buffer costs little next to the I/O.  It catches corruption,
+     * not tampering.  SHA256 is available for callers that want a cryptographic digest and can
+     * afford the slower hash.
+     */
+    class ContentHasher
+    {
+    public:
+        enum class Algorithm
+        {
+            XXH3,
+            SHA256
+        };
+
+        struct Digest
+        {
+            std::array<uint8_t, 32> bytes{};
+            size_t length{0};
+
+            auto operator==(const Digest & other) const -> bool = default;
+
+            /**
+             * @return the digest as lower case hexadecimal.
+             */
+            [[nodiscard]] auto to_string() const -> std::string;
+        };
+
+        explicit ContentHasher(Algorithm algorithm);
+
+        ContentHasher(const ContentHasher &) = delete;
+
+        ContentHasher & operator=(const ContentHasher &) = delete;
+
+        ~ContentHasher();
+
+        void update(const void * data, size_t length);
+
+        /**
+         * @return the digest of everything passed to update() since construction or the last reset().
+         */
+        [[nodiscard]] auto digest() const -> Digest;
+
+        void reset();
+
+        [[nodiscard]] auto algorithm() const -> Algorithm
+        {
+            return m_algorithm;
+        }
+
+        [[nodiscard]] static auto name_of(Algorithm algorithm) -> const char *;
+
+        /**
+         * @brief method to look up an algorithm by the name name_of() returns, ignoring case.
+         * @return false if @e name is not an algorithm.
+         */
+        static auto algorithm_named(const std::string & name, Algorithm & algorithm) -> bool;
+
+    private:
+        struct State;
+
+        Algorithm m_algorithm{Algorithm::XXH3};
+        std::unique_ptr<State> m_state{};
+    };
+
+} // namespace copy
+
+#endif // CONTENT_HASH_HPP
@@ -0,0 +1,157 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include "content_verifier.hpp"
+#include "file_descriptor.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        constexpr size_t verify_buffer_size{1024 * 1024};
+    } // namespace
+
+    ContentVerifier::ContentVerifier(ContentHasher::Algorithm algorithm, size_type workers) :
+        m_algorithm{algorithm}, m_worker_count{workers > 0 ? workers : 1}
+    {}
+
+    auto ContentVerifier::verify(const std::vector<Checksum> & checksums, const std::string & destination_root)
+        -> size_type
+    {
+#if defined(__linux__)
+        // One syncfs(2) writes back the whole tree far faster than a flush per file.  Pages that are
+        // still dirty cannot be dropped, and would be read back from memory.
+        FileDescriptor root{::open(destination_root.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (! root.is_valid() || ::syncfs(root.get()) != 0)
+        {
+            ::sync();
+        }
+#else
+        (void)destination_root;
+        ::sync();
+#endif
+
+        std::atomic<size_t> next{0};
+        std::atomic<size_type> mismatches{0};
+
+        auto worker = [this, &checksums, &next, &mismatches] {
+            ContentHasher hasher{m_algorithm};
+            std::vector<char> buffer(verify_buffer_size);
+            for (auto index = next++; index < checksums.size() && ! interrupted(); index = next++)
+            {
+                const auto reason = check(checksums[index], hasher, buffer);
+                if (! reason.empty())
+                {
+                    mismatches++;
+                    if (m_mismatch_callback)
+                    {
+                        m_mismatch_callback(checksums[index], String{reason.c_str()});
+                    }
+                }
+            }
+        };
+
+        const auto thread_count = std::min<size_type>(m_worker_count, checksums.size());
+        std::vector<std::thread> threads{};
+        for (size_type i = 1; i < thread_count; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+
+        return mismatches;
+    }
+
+    auto ContentVerifier::check(const Checksum & checksum, ContentHasher & hasher, std::vector<char> & buffer) const
+        -> std::string
+    {
+        const auto path = checksum.destination_path.stlStringInUTF8();
+        FileDescriptor file{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (! file.is_valid())
+        {
+            return std::string{"unable to open: "} + std::strerror(errno);
+        }
+
+        auto offset = checksum.offset;
+        const auto end =
+            checksum.whole_file ? std::numeric_limits<size_type>::max() : checksum.offset + checksum.length;
+
+#if defined(__linux__)
+        const auto advice_length = checksum.whole_file ? 0 : static_cast<off_t>(checksum.length);
+        ::posix_fadvise(file.get(), static_cast<off_t>(offset), advice_length, POSIX_FADV_DONTNEED);
+#endif
+
+        hasher.reset();
+        while (offset < end)
+        {
+            const auto length = static_cast<size_t>(std::min<size_type>(buffer.size(), end - offset));
+            const auto bytes_read = ::pread(file.get(), buffer.data(), length, static_cast<off_t>(offset));
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return std::string{"unable to read: "} + std::strerror(errno);
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            hasher.update(buffer.data(), static_cast<size_t>(bytes_read));
+            offset += static_cast<size_type>(bytes_read);
+        }
+
+        if (offset - checksum.offset != checksum.length)
+        {
+            return "size differs: expected " + std::to_string(checksum.length) + " bytes, found " +
+                   std::to_string(offset - checksum.offset);
+        }
+
+        const auto digest = hasher.digest();
+        if (digest != checksum.digest)
+        {
+            return std::string{ContentHasher::name_of(m_algorithm)} + " differs: expected " +
+                   checksum.digest.to_string() + ", found " + digest.to_string();
+        }
+        return {};
+    }
+
+} // namespace copy
@@ -0,0 +1,105 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef CONTENT_VERIFIER_HPP
+#define CONTENT_VERIFIER_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "TFFoundation.hpp"
+#include "content_hash.hpp"
+#include "copy_engine.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    /**
+     * @brief class that re-reads copied files and compares them with the digests taken during the
+     * copy.
+     *
+     * The destination is flushed to disk first and each file's pages are dropped from the page
+     * cache before it is read, so the check sees what the storage returns rather than the copy's
+     * own cached writes.  Files are checked on a pool of worker threads.
+     */
+    class ContentVerifier
+    {
+    public:
+        using size_type = uint64_t;
+        using Checksum = CopyEngine::Checksum;
+        using mismatch_callback_type = std::function<void(const Checksum & checksum, const String & reason)>;
+        using interrupter_type = std::function<bool()>;
+
+        ContentVerifier(ContentHasher::Algorithm algorithm, size_type workers);
+
+        /**
+         * @brief method to set the callback for every file or range that does not match.  It is
+         * called from the worker threads.
+         */
+        void set_mismatch_callback(mismatch_callback_type callback)
+        {
+            m_mismatch_callback = std::move(callback);
+        }
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to check every checksum.  Blocks until done.
+         * @param checksums the digests recorded by CopyEngine.
+         * @param destination_root any path on the destination file system; it is synced before the
+         * files are read back.
+         * @return the number of mismatches.
+         */
+        auto verify(const std::vector<Checksum> & checksums, const std::string & destination_root) -> size_type;
+
+    private:
+        ContentHasher::Algorithm m_algorithm{ContentHasher::Algorithm::XXH3};
+        size_type m_worker_count{1};
+        mismatch_callback_type m_mismatch_callback{};
+        interrupter_type m_interrupter{};
+
+        /**
+         * @return an empty string if the destination matches @e checksum, otherwise the reason it
+         * does not.
+         */
+        auto check(const Checksum & checksum, ContentHasher & hasher, std::vector<char> & buffer) const
+            -> std::string;
+
+        [[nodiscard]] auto interrupted() const -> bool
+        {
+            return m_interrupter && m_interrupter();
+        }
+    };
+
+} // namespace copy
+
+#endif // CONTENT_VERIFIER_HPP
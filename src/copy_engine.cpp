@@ -0,0 +1,899 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "copy_engine.hpp"
+#include "file_copier.hpp"
+#include "file_descriptor.hpp"
+#include "file_inventory.hpp"
+#include "thread_index.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        // A batch of 32 files with 64 KiB buffers keeps 2 MiB of buffers per worker.
+        constexpr CopyEngine::size_type uring_batch_size{32};
+        constexpr CopyEngine::size_type uring_buffer_size{64 * 1024};
+
+        constexpr CopyEngine::size_type large_file_range_size{64 * 1024 * 1024};
+
+        // How much of each file or range the prefetch thread asks for.  The kernel's own readahead
+        // takes over once the worker reads past it, and a bounded window keeps a deep prefetch from
+        // pushing the data about to be copied out of the page cache.
+        constexpr CopyEngine::size_type prefetch_window_size{8 * 1024 * 1024};
+
+        constexpr int64_t nanoseconds_per_second{1'000'000'000};
+
+        auto same_contents(const std::string & source_path, const std::string & destination_path,
+                           CopyEngine::size_type size, BufferPool * pool) -> bool
+        {
+            FileDescriptor source{::open(source_path.c_str(), O_RDONLY | O_CLOEXEC)};
+            FileDescriptor destination{::open(destination_path.c_str(), O_RDONLY | O_CLOEXEC)};
+            if (! source.is_valid() || ! destination.is_valid())
+            {
+                return false;
+            }
+
+            BufferPool local_pool{};
+            auto & buffers = pool ? *pool : local_pool;
+            const auto source_buffer = buffers.acquire(size);
+            const auto destination_buffer = buffers.acquire(size);
+            const auto buffer_size = static_cast<size_t>(source_buffer.size());
+            while (true)
+            {
+                const auto source_read = ::read(source.get(), source_buffer.data(), buffer_size);
+                const auto destination_read = ::read(destination.get(), destination_buffer.data(), buffer_size);
+                if (source_read < 0 || source_read != destination_read)
+                {
+                    return false;
+                }
+                if (source_read == 0)
+                {
+                    return true;
+                }
+                if (std::memcmp(source_buffer.data(), destination_buffer.data(), static_cast<size_t>(source_read)) !=
+                    0)
+                {
+                    return false;
+                }
+            }
+        }
+    } // namespace
+
+    struct CopyEngine::LargeFile
+    {
+        FileDescriptor source{};
+        FileDescriptor destination{};
+        std::atomic<size_type> ranges_remaining{0};
+        std::atomic<size_type> copied_bytes{0}; // the progress reported so far, resumed ranges included
+        std::atomic<bool> started{false};
+        std::atomic<bool> failed{false};
+    };
+
+    CopyEngine::CopyEngine(size_type workers) :
+        m_worker_count{workers > 0 ? workers : 1}, m_queue_limit{m_worker_count * 4}
+    {}
+
+    CopyEngine::~CopyEngine()
+    {
+        stop();
+        finish();
+    }
+
+    void CopyEngine::set_prefetch_depth(size_type files)
+    {
+        m_prefetch_depth = files;
+        // The queue must hold the files being read ahead.
+        m_queue_limit = std::max(m_worker_count * 4, files);
+    }
+
+    void CopyEngine::start()
+    {
+#if defined(__linux__)
+        m_prefetching = m_prefetch_depth > 0 && m_cache_mode != FileCopier::CacheMode::Direct &&
+                        m_sync_mode == SyncMode::Off;
+#endif
+        if (m_prefetching)
+        {
+            m_prefetcher = std::thread{[this] {
+                prefetch_loop();
+            }};
+        }
+
+        for (size_type worker = 0; worker < m_worker_count; worker++)
+        {
+            m_workers.emplace_back([this, worker] {
+                // Numbered from 0, each worker counts progress in a slot of its own.
+                set_current_thread_index(worker);
+                worker_loop(worker);
+            });
+        }
+    }
+
+    auto CopyEngine::submit(Job job) -> bool
+    {
+        job.id = ++m_next_job_id;
+
+        // A worker splits a huge file, so comparing it with its destination does not hold up the queue.
+        const auto split = size_class_of(job) == SizeClass::Huge;
+        return enqueue(Task{std::move(job), nullptr, 0, 0, split});
+    }
+
+    auto CopyEngine::enqueue(Task task) -> bool
+    {
+        std::unique_lock<std::mutex> lock(m_queue_mutex);
+        m_queue_has_room.wait(lock, [this] {
+            return m_queue.size() < m_queue_limit || should_stop();
+        });
+
+        if (should_stop())
+        {
+            return false;
+        }
+
+        push_task(std::move(task));
+        lock.unlock();
+        m_queue_has_work.notify_one();
+        if (m_prefetching)
+        {
+            m_prefetch_ready.notify_one();
+        }
+        return true;
+    }
+
+    void CopyEngine::enqueue_ranges(std::vector<Task> & tasks)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            for (auto & task : tasks)
+            {
+                push_task(std::move(task));
+            }
+        }
+        m_queue_has_work.notify_all();
+        if (m_prefetching)
+        {
+            m_prefetch_ready.notify_one();
+        }
+    }
+
+    void CopyEngine::push_task(Task task)
+    {
+        // The split task is read ahead through its ranges instead.
+        if (m_prefetching && ! task.split)
+        {
+            m_prefetch_queue.push_back(
+                PrefetchItem{task.job, ! task.large_file, task.offset, task.length, m_enqueued});
+        }
+        m_enqueued++;
+        m_queue.emplace_back(std::move(task));
+    }
+
+    void CopyEngine::split_large_file(const Job & job)
+    {
+        // Splitting truncates the destination right away, so compare it first.
+        if (skip_if_up_to_date(job))
+        {
+            return;
+        }
+
+        const auto source_path = job.source_path.stlStringInUTF8();
+        const auto destination_path = job.destination_path.stlStringInUTF8();
+
+        PhaseTimings::Timer open_timer{m_timings, PhaseTimings::Phase::Open};
+        auto large_file = std::make_shared<LargeFile>();
+        large_file->source.reset(::open(source_path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (! large_file->source.is_valid())
+        {
+            report_error(job, String{"unable to open: "} + std::strerror(errno));
+            return;
+        }
+#if defined(__linux__)
+        // Each range is read front to back, so a larger readahead window pays off.
+        ::posix_fadvise(large_file->source.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        // Ranges an earlier run finished are kept, as long as the destination still has the full size.
+        auto finished_ranges =
+            m_journal ? m_journal->finished_ranges(destination_path, job.size, job.modification_time)
+                      : std::vector<size_type>{};
+        const auto flags = O_WRONLY | O_CREAT | O_CLOEXEC | (finished_ranges.empty() ? O_TRUNC : 0);
+        large_file->destination.reset(::open(destination_path.c_str(), flags, job.mode & 07777));
+        if (! large_file->destination.is_valid())
+        {
+            report_error(job, String{"unable to open destination: "} + std::strerror(errno));
+            return;
+        }
+
+        struct stat status
+        {};
+        if (! finished_ranges.empty() && (::fstat(large_file->destination.get(), &status) != 0 ||
+                                          static_cast<size_type>(status.st_size) != job.size))
+        {
+            finished_ranges.clear();
+            if (::ftruncate(large_file->destination.get(), 0) != 0)
+            {
+                report_error(job, String{"unable to truncate: "} + std::strerror(errno));
+                return;
+            }
+        }
+
+        // Reserve the whole file up front so the ranges land in place instead of extending the file
+        // out of order.  A sparse file is only sized, since reserving would allocate its holes.
+        const auto size = static_cast<off_t>(job.size);
+#if defined(__linux__)
+        const auto sparse = job.allocated_size < job.size;
+        if ((sparse || ::fallocate(large_file->destination.get(), 0, 0, size) != 0) &&
+            ::ftruncate(large_file->destination.get(), size) != 0)
+#else
+        if (::ftruncate(large_file->destination.get(), size) != 0)
+#endif
+        {
+            report_error(job, String{"unable to preallocate: "} + std::strerror(errno));
+            return;
+        }
+        open_timer.stop();
+
+        std::vector<Task> tasks{};
+        size_type resumed_bytes{0};
+        for (size_type offset = 0; offset < job.size; offset += large_file_range_size)
+        {
+            const auto length = std::min(large_file_range_size, job.size - offset);
+            if (std::find(finished_ranges.begin(), finished_ranges.end(), offset) != finished_ranges.end())
+            {
+                // Progress counts data, not holes.
+                resumed_bytes += job.allocated_size < job.size
+                                     ? FileCopier::data_bytes(large_file->source.get(), offset, length)
+                                     : length;
+                continue;
+            }
+            tasks.push_back(Task{job, large_file, offset, length});
+        }
+
+        if (resumed_bytes > 0)
+        {
+            large_file->copied_bytes = resumed_bytes;
+            large_file->started = true;
+            if (m_file_started_callback)
+            {
+                m_file_started_callback(job);
+            }
+            if (m_progress_callback)
+            {
+                m_progress_callback(job, resumed_bytes);
+            }
+        }
+
+        if (tasks.empty())
+        {
+            // Every range was finished, but the run stopped before the file was recorded, and
+            // perhaps before its metadata was copied.
+            complete_large_file(job, *large_file);
+            return;
+        }
+
+        // The ranges skip the queue limit: the worker splitting the file must not wait for room that
+        // only workers can make.  A file has few enough ranges that the overshoot does not matter.
+        large_file->ranges_remaining = tasks.size();
+        enqueue_ranges(tasks);
+    }
+
+    void CopyEngine::finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_finishing = true;
+        }
+        m_queue_has_work.notify_all();
+        m_queue_has_room.notify_all();
+        m_prefetch_ready.notify_all();
+
+        for (auto & worker : m_workers)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+        m_workers.clear();
+
+        if (m_prefetcher.joinable())
+        {
+            m_prefetcher.join();
+        }
+    }
+
+    void CopyEngine::worker_loop(size_type worker)
+    {
+        std::unique_ptr<ContentHasher> hasher{};
+        if (m_verify)
+        {
+            hasher = std::make_unique<ContentHasher>(m_verify_algorithm);
+        }
+
+        std::unique_ptr<UringCopier> uring{};
+        if (m_use_io_uring && m_cache_mode != FileCopier::CacheMode::Normal)
+        {
+            if (worker == 0)
+            {
+                LOG(LogPriority::Info, "io_uring batches fill the page cache, using the regular copy path")
+            }
+        }
+        else if (m_use_io_uring)
+        {
+            uring = std::make_unique<UringCopier>(uring_batch_size, uring_buffer_size);
+            if (! uring->is_available())
+            {
+                if (worker == 0)
+                {
+                    LOG(LogPriority::Info, "io_uring is not available, using the regular copy path")
+                }
+                uring.reset();
+            }
+            else
+            {
+                uring->set_interrupter([this]() -> bool {
+                    return should_stop();
+                });
+                uring->set_timings(m_timings);
+                uring->set_hasher(hasher.get());
+            }
+        }
+
+        // The ring writes whole buffers, holes included, so sparse files take the regular path.
+        auto fits_in_ring = [&uring](const Task & task) -> bool {
+            return uring && ! task.large_file && task.job.size < uring->buffer_size() &&
+                   task.job.allocated_size >= task.job.size;
+        };
+
+        std::vector<Task> tasks{};
+        std::vector<Job> jobs{};
+        while (true)
+        {
+            tasks.clear();
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                // A file being split still adds ranges, so finishing waits for it.
+                m_queue_has_work.wait(lock, [this] {
+                    return ! m_queue.empty() || (m_finishing && m_splitting == 0) || should_stop();
+                });
+
+                if (should_stop() || m_queue.empty())
+                {
+                    // Either stopped, or finishing with nothing left to do.  Wake the producer in case
+                    // it is still blocked in submit().
+                    m_queue.clear();
+                    lock.unlock();
+                    m_queue_has_room.notify_all();
+                    m_queue_has_work.notify_all();
+                    m_prefetch_ready.notify_all();
+                    return;
+                }
+
+                tasks.emplace_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+                if (tasks.front().split)
+                {
+                    m_splitting++;
+                }
+
+                // Small files travel through the ring together, so take the run of small files that follows.
+                while (fits_in_ring(tasks.front()) && tasks.size() < uring->batch_size() && ! m_queue.empty() &&
+                       fits_in_ring(m_queue.front()))
+                {
+                    tasks.emplace_back(std::move(m_queue.front()));
+                    m_queue.pop_front();
+                }
+                m_dequeued += tasks.size();
+            }
+            m_queue_has_room.notify_all();
+            if (m_prefetching)
+            {
+                // The window moved on.
+                m_prefetch_ready.notify_one();
+            }
+
+            if (tasks.front().split)
+            {
+                split_large_file(tasks.front().job);
+                {
+                    std::lock_guard<std::mutex> lock(m_queue_mutex);
+                    m_splitting--;
+                }
+                m_queue_has_work.notify_all();
+            }
+            else if (tasks.front().large_file)
+            {
+                copy_range(tasks.front(), hasher.get());
+            }
+            else if (fits_in_ring(tasks.front()))
+            {
+                jobs.clear();
+                for (auto & task : tasks)
+                {
+                    jobs.emplace_back(std::move(task.job));
+                }
+                copy_batch(*uring, jobs, hasher.get());
+            }
+            else
+            {
+                copy_job(tasks.front().job, hasher.get());
+            }
+        }
+    }
+
+    void CopyEngine::prefetch_loop()
+    {
+        while (true)
+        {
+            PrefetchItem item{};
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                m_prefetch_ready.wait(lock, [this] {
+                    return should_stop() || (m_finishing && m_prefetch_queue.empty()) ||
+                           (! m_prefetch_queue.empty() &&
+                            m_prefetch_queue.front().sequence < m_dequeued + m_prefetch_depth);
+                });
+
+                if (should_stop() || m_prefetch_queue.empty())
+                {
+                    m_prefetch_queue.clear();
+                    return;
+                }
+
+                item = std::move(m_prefetch_queue.front());
+                m_prefetch_queue.pop_front();
+                if (item.sequence < m_dequeued)
+                {
+                    // A worker already took it, so reading ahead is too late.
+                    continue;
+                }
+            }
+            prefetch(item);
+        }
+    }
+
+    void CopyEngine::prefetch(const PrefetchItem & item)
+    {
+#if defined(__linux__)
+        const auto length = std::min(item.whole_file ? item.job.size : item.length, prefetch_window_size);
+        if (length == 0)
+        {
+            return;
+        }
+
+        // Ranges were already compared with the journal when the file was split.
+        if (item.whole_file && m_journal &&
+            m_journal->is_finished(item.job.destination_path.stlStringInUTF8(), item.job.size,
+                                   item.job.modification_time))
+        {
+            return;
+        }
+
+        // The page cache belongs to the file, not the descriptor, so a descriptor of our own will do;
+        // the one a large file shares is closed by whichever worker copies its last range.
+        FileDescriptor source{::open(item.job.source_path.stlStringInUTF8().c_str(), O_RDONLY | O_CLOEXEC)};
+        if (source.is_valid())
+        {
+            ::posix_fadvise(source.get(), static_cast<off_t>(item.offset), static_cast<off_t>(length),
+                            POSIX_FADV_WILLNEED);
+        }
+#else
+        (void)item;
+#endif
+    }
+
+    void CopyEngine::copy_job(const Job & job, ContentHasher * hasher)
+    {
+        if (skip_if_up_to_date(job))
+        {
+            return;
+        }
+
+        throttle(0, 1);
+        if (m_file_started_callback)
+        {
+            m_file_started_callback(job);
+        }
+
+        size_type copied_bytes{0};
+        auto notifier = ItemCopier::notifier_type{[this, &job, &copied_bytes](auto & size) {
+            copied_bytes += size;
+            if (m_progress_callback)
+            {
+                m_progress_callback(job, size);
+            }
+            throttle(size, 0);
+        }};
+
+        auto interrupter = [this]() -> bool {
+            return should_stop();
+        };
+
+        try
+        {
+            auto copier = FileCopier{job.source_path, job.destination_path};
+            copier.set_notifier(notifier);
+            copier.set_interrupter(interrupter);
+            copier.set_timings(m_timings);
+            copier.set_buffer_pool(m_buffer_pool);
+            copier.set_cache_mode(m_cache_mode);
+            copier.set_metadata(m_metadata);
+            if (hasher)
+            {
+                hasher->reset();
+                copier.set_hasher(hasher);
+            }
+            if (size_class_of(job) == SizeClass::Tiny)
+            {
+                copier.copy_small(job.size, job.mode);
+            }
+            else
+            {
+                copier.copy();
+            }
+        }
+        catch (std::exception & e)
+        {
+            report_error(job, e.what());
+            return;
+        }
+
+        if (hasher && ! should_stop())
+        {
+            record_checksum(Checksum{job.destination_path, true, 0, job.size, hasher->digest()});
+        }
+
+        finish_job(job, copied_bytes);
+    }
+
+    void CopyEngine::copy_batch(UringCopier & uring, std::vector<Job> & jobs, ContentHasher * hasher)
+    {
+        if (m_journal || m_sync_mode != SyncMode::Off)
+        {
+            std::erase_if(jobs, [this](const Job & job) {
+                return skip_if_up_to_date(job);
+            });
+            if (jobs.empty())
+            {
+                return;
+            }
+        }
+
+        // The ring moves the whole batch at once, so it is paid for up front.
+        size_type batch_bytes{0};
+        for (const auto & job : jobs)
+        {
+            batch_bytes += job.size;
+        }
+        throttle(batch_bytes, jobs.size());
+
+        std::vector<UringCopier::Request> requests{};
+        requests.reserve(jobs.size());
+        for (const auto & job : jobs)
+        {
+            if (m_file_started_callback)
+            {
+                m_file_started_callback(job);
+            }
+            requests.push_back(UringCopier::Request{job.source_path.stlStringInUTF8(),
+                                                    job.destination_path.stlStringInUTF8(), job.mode});
+        }
+
+        std::vector<size_type> copied_bytes(jobs.size(), 0);
+        uring.set_notifier([this, &jobs, &copied_bytes](auto request, auto bytes) {
+            copied_bytes[request] += bytes;
+            if (m_progress_callback)
+            {
+                m_progress_callback(jobs[request], bytes);
+            }
+        });
+
+        std::vector<int> results{};
+        uring.copy(requests, results);
+
+        for (size_t i = 0; i < jobs.size() && ! should_stop(); i++)
+        {
+            if (results[i] == UringCopier::file_too_large)
+            {
+                // The file grew since the scan; copy it the regular way.
+                copy_job(jobs[i], hasher);
+            }
+            else if (results[i] != 0)
+            {
+                report_error(jobs[i], std::strerror(results[i]));
+            }
+            else
+            {
+                if (hasher)
+                {
+                    record_checksum(Checksum{jobs[i].destination_path, true, 0, jobs[i].size, uring.digests()[i]});
+                }
+                apply_metadata_by_path(jobs[i]);
+                finish_job(jobs[i], copied_bytes[i]);
+            }
+        }
+    }
+
+    void CopyEngine::copy_range(const Task & task, ContentHasher * hasher)
+    {
+        auto & large_file = *task.large_file;
+        const auto & job = task.job;
+
+        if (! large_file.failed && ! should_stop())
+        {
+            if (! large_file.started.exchange(true))
+            {
+                throttle(0, 1);
+                if (m_file_started_callback)
+                {
+                    m_file_started_callback(job);
+                }
+            }
+
+            auto notifier = ItemCopier::notifier_type{[this, &job, &large_file](auto & size) {
+                large_file.copied_bytes += size;
+                if (m_progress_callback)
+                {
+                    m_progress_callback(job, size);
+                }
+                throttle(size, 0);
+            }};
+
+            try
+            {
+                auto copier = FileCopier{job.source_path, job.destination_path};
+                copier.set_notifier(notifier);
+                copier.set_interrupter([this]() -> bool {
+                    return should_stop();
+                });
+                copier.set_timings(m_timings);
+                copier.set_buffer_pool(m_buffer_pool);
+                copier.set_cache_mode(m_cache_mode);
+                if (hasher)
+                {
+                    hasher->reset();
+                    copier.set_hasher(hasher);
+                }
+                copier.copy_range(large_file.source.get(), large_file.destination.get(), task.offset, task.length);
+            }
+            catch (std::exception & e)
+            {
+                large_file.failed = true;
+                report_error(job, e.what());
+            }
+
+            if (hasher && ! large_file.failed && ! should_stop())
+            {
+                record_checksum(Checksum{job.destination_path, false, task.offset, task.length, hasher->digest()});
+            }
+
+            if (m_journal && ! large_file.failed && ! should_stop())
+            {
+                m_journal->record_range(job.destination_path.stlStringInUTF8(), job.size, job.modification_time,
+                                        task.offset);
+            }
+        }
+
+        // The last range to finish completes the file.
+        if (--large_file.ranges_remaining == 0 && ! large_file.failed && ! should_stop())
+        {
+            complete_large_file(job, large_file);
+        }
+    }
+
+    void CopyEngine::complete_large_file(const Job & job, LargeFile & large_file)
+    {
+        struct stat status
+        {};
+        if (m_metadata && ::fstat(large_file.source.get(), &status) == 0)
+        {
+            PhaseTimings::Timer metadata_timer{m_timings, PhaseTimings::Phase::Chmod};
+            m_metadata->apply(large_file.source.get(), large_file.destination.get(), status,
+                              job.destination_path.stlStringInUTF8());
+        }
+
+        PhaseTimings::Timer close_timer{m_timings, PhaseTimings::Phase::Close};
+        large_file.source.close();
+        if (large_file.destination.close() != 0)
+        {
+            report_error(job, String{"unable to close: "} + std::strerror(errno));
+            return;
+        }
+        close_timer.stop();
+        finish_job(job, large_file.copied_bytes);
+    }
+
+    void CopyEngine::apply_metadata_by_path(const Job & job)
+    {
+        if (m_metadata == nullptr || should_stop())
+        {
+            return;
+        }
+
+        // The mode comes from the scan's inventory; anything more needs the source's status.
+        PhaseTimings::Timer timer{m_timings, PhaseTimings::Phase::Chmod};
+        const auto source_path = job.source_path.stlStringInUTF8();
+        const auto & attributes = m_metadata->attributes();
+        struct stat status
+        {};
+        status.st_mode = static_cast<mode_t>(job.mode);
+        if ((attributes.times || attributes.ownership || attributes.extended_attributes) &&
+            ::stat(source_path.c_str(), &status) != 0)
+        {
+            LOG(LogPriority::Warning, "Unable to copy the metadata of " + job.source_path + ": " + std::strerror(errno))
+            return;
+        }
+        m_metadata->apply(source_path, job.destination_path.stlStringInUTF8(), status);
+    }
+
+    void CopyEngine::finish_job(const Job & job, size_type copied_bytes)
+    {
+        if (should_stop())
+        {
+            return;
+        }
+
+        if (copied_bytes != job.allocated_size && m_size_corrected_callback)
+        {
+            m_size_corrected_callback(job, copied_bytes);
+        }
+
+        if (m_journal)
+        {
+            m_journal->record_finished(job.destination_path.stlStringInUTF8(), job.size, job.modification_time);
+        }
+
+        if (m_file_finished_callback)
+        {
+            m_file_finished_callback(job);
+        }
+    }
+
+    auto CopyEngine::size_class_of(const Job & job) const -> SizeClass
+    {
+        if (m_large_file_threshold > 0 && m_worker_count > 1 && job.size >= m_large_file_threshold)
+        {
+            return SizeClass::Huge;
+        }
+        if (job.size <= tiny_file_size && job.allocated_size >= job.size &&
+            m_cache_mode == FileCopier::CacheMode::Normal)
+        {
+            return SizeClass::Tiny;
+        }
+        return SizeClass::Medium;
+    }
+
+    void CopyEngine::record_checksum(Checksum checksum)
+    {
+        std::lock_guard<std::mutex> lock(m_checksums_mutex);
+        m_checksums.emplace_back(std::move(checksum));
+    }
+
+    auto CopyEngine::skip_if_up_to_date(const Job & job) -> bool
+    {
+        if (m_journal == nullptr && m_sync_mode == SyncMode::Off)
+        {
+            return false;
+        }
+
+        const auto destination_path = job.destination_path.stlStringInUTF8();
+
+        // A file the journal recorded is trusted without looking at the destination; that is what
+        // makes a resume fast.
+        if (m_journal && m_journal->is_finished(destination_path, job.size, job.modification_time))
+        {
+            if (m_file_skipped_callback)
+            {
+                m_file_skipped_callback(job);
+            }
+            return true;
+        }
+
+        if (m_sync_mode == SyncMode::Off)
+        {
+            return false;
+        }
+
+        struct stat status
+        {};
+        PhaseTimings::Timer stat_timer{m_timings, PhaseTimings::Phase::Stat};
+        const auto stat_result = ::stat(destination_path.c_str(), &status);
+        stat_timer.stop();
+        if (stat_result != 0 || ! S_ISREG(status.st_mode) || static_cast<size_type>(status.st_size) != job.size)
+        {
+            return false;
+        }
+
+        if (m_sync_mode == SyncMode::Content)
+        {
+            if (! same_contents(job.source_path.stlStringInUTF8(), destination_path, job.size, m_buffer_pool))
+            {
+                return false;
+            }
+        }
+        else if (FileInventory::modification_time(status) / nanoseconds_per_second !=
+                 job.modification_time / nanoseconds_per_second)
+        {
+            return false;
+        }
+
+        if (m_file_skipped_callback)
+        {
+            m_file_skipped_callback(job);
+        }
+        return true;
+    }
+
+    void CopyEngine::report_error(const Job & job, const String & message)
+    {
+        m_encountered_error = true;
+        if (m_error_callback)
+        {
+            m_error_callback(job, message);
+        }
+        stop();
+    }
+
+    void CopyEngine::throttle(size_type bytes, size_type files)
+    {
+        if (m_throttle && m_throttle->is_limited())
+        {
+            m_throttle->wait(bytes, files, [this]() -> bool {
+                return should_stop();
+            });
+        }
+    }
+
+    void CopyEngine::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_stopped = true;
+        }
+        m_queue_has_work.notify_all();
+        m_queue_has_room.notify_all();
+        m_prefetch_ready.notify_all();
+    }
+
+    auto CopyEngine::should_stop() const -> bool
+    {
+        if (m_stopped)
+        {
+            return true;
+        }
+        return m_interrupter && m_interrupter();
+    }
+
+} // namespace copy
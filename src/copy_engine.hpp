@@ -0,0 +1,462 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef COPY_ENGINE_HPP
+#define COPY_ENGINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "TFFoundation.hpp"
+#include "buffer_pool.hpp"
+#include "content_hash.hpp"
+#include "copy_journal.hpp"
+#include "file_copier.hpp"
+#include "phase_timings.hpp"
+#include "throttle.hpp"
+#include "uring_copier.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    /**
+     * @brief class that copies files on a bounded pool of worker threads.
+     *
+     * The producer (the walk in CopyPanel) calls submit() for every file it finds.  submit() blocks
+     * once the queue holds more than a few jobs per worker so the walk never races far ahead of the
+     * copies.  The engine only copies files; the producer must create a file's destination directory
+     * before it submits the file.
+     *
+     * Each file goes to a strategy picked by its size from the scan (see SizeClass).  Files at or
+     * above the large file threshold are split into ranges by a worker.  Several workers copy the
+     * ranges at once with positional I/O into a destination preallocated to the full size.  All
+     * ranges of a file report progress under the same Job::id.
+     *
+     * Progress counts the bytes of data copied, so the holes of a sparse file do not count; a job
+     * reports about Job::allocated_size bytes in all.  When a finished file came to a different
+     * amount, because it changed since the scan or its blocks do not match its data, the size
+     * corrected callback gets the bytes actually copied so a total can be adjusted once per file.
+     *
+     * With verification on, every copied file, or every range of a large file, is hashed on its way
+     * through and recorded as a Checksum for a later pass to compare with the destination.
+     */
+    class CopyEngine
+    {
+    public:
+        using size_type = uint64_t;
+
+        struct Job
+        {
+            String source_path{};
+            String destination_path{};
+            size_type size{0};
+            size_type allocated_size{0}; // the bytes of data, less than size for a sparse file
+            uint32_t mode{0};
+            int64_t modification_time{0}; // nanoseconds since the epoch
+            size_type id{0};               // assigned by submit()
+        };
+
+        /**
+         * @brief the digest of the data copied to a destination, for the whole file or for the range
+         * [offset, offset + length) of a large file.
+         */
+        struct Checksum
+        {
+            String destination_path{};
+            bool whole_file{true};
+            size_type offset{0};
+            size_type length{0};
+            ContentHasher::Digest digest{};
+        };
+
+        using progress_callback_type = std::function<void(const Job & job, size_type bytes)>;
+        using file_callback_type = std::function<void(const Job & job)>;
+        using size_callback_type = std::function<void(const Job & job, size_type copied_bytes)>;
+        using error_callback_type = std::function<void(const Job & job, const String & message)>;
+        using interrupter_type = std::function<bool()>;
+
+        enum class SyncMode
+        {
+            Off,
+            SizeAndTime,
+            Content
+        };
+
+        /**
+         * @brief the copy strategies by file size.  Tiny files take one read and one write
+         * (FileCopier::copy_small()) and report their progress once.  Medium files go through the
+         * kernel copy paths of FileCopier::copy().  Huge files are split into ranges that several
+         * workers copy at once.  With io_uring on, tiny files travel in batches through the ring
+         * instead.
+         */
+        enum class SizeClass
+        {
+            Tiny,
+            Medium,
+            Huge
+        };
+
+        // The largest tiny file; progress displays can leave files this small out of their gauges.
+        static constexpr size_type tiny_file_size{FileCopier::small_file_size};
+
+        explicit CopyEngine(size_type workers);
+
+        CopyEngine(const CopyEngine &) = delete;
+
+        CopyEngine & operator=(const CopyEngine &) = delete;
+
+        ~CopyEngine();
+
+        void set_progress_callback(progress_callback_type callback)
+        {
+            m_progress_callback = std::move(callback);
+        }
+
+        void set_file_started_callback(file_callback_type callback)
+        {
+            m_file_started_callback = std::move(callback);
+        }
+
+        void set_file_finished_callback(file_callback_type callback)
+        {
+            m_file_finished_callback = std::move(callback);
+        }
+
+        /**
+         * @brief method to set the callback for files that sync mode found already up to date.
+         */
+        void set_file_skipped_callback(file_callback_type callback)
+        {
+            m_file_skipped_callback = std::move(callback);
+        }
+
+        /**
+         * @brief method to set the callback for a finished file whose progress did not add up to
+         * Job::allocated_size.  It runs before the finished callback.
+         */
+        void set_size_corrected_callback(size_callback_type callback)
+        {
+            m_size_corrected_callback = std::move(callback);
+        }
+
+        void set_error_callback(error_callback_type callback)
+        {
+            m_error_callback = std::move(callback);
+        }
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to send small files through io_uring in batches when the kernel supports it.
+         * The batches go through the page cache, so a cache mode other than Normal turns them off.
+         * Call before start().
+         */
+        void set_use_io_uring(bool use)
+        {
+            m_use_io_uring = use;
+        }
+
+        /**
+         * @brief method to skip files whose destination already matches the source.  SizeAndTime
+         * compares the size and the modification time to the second, like rsync's quick check.
+         * Content compares the bytes of files with equal sizes.  The next run can only skip the files
+         * this one copies if the metadata copier carries their times over.  Call before start().
+         */
+        void set_sync_mode(SyncMode mode)
+        {
+            m_sync_mode = mode;
+        }
+
+        /**
+         * @brief method to record finished files and ranges in @e journal, and to skip the ones an
+         * earlier run recorded.  The journal must outlive the engine.  Call before start().
+         */
+        void set_journal(CopyJournal * journal)
+        {
+            m_journal = journal;
+        }
+
+        /**
+         * @brief method to record how long each phase of a copy takes in @e timings, which must
+         * outlive the engine.  Call before start().
+         */
+        void set_timings(PhaseTimings * timings)
+        {
+            m_timings = timings;
+        }
+
+        /**
+         * @brief method to take I/O buffers from @e pool, which must outlive the engine and also
+         * tunes their size.  Call before start().
+         */
+        void set_buffer_pool(BufferPool * pool)
+        {
+            m_buffer_pool = pool;
+        }
+
+        /**
+         * @brief method to copy the metadata of every finished file with @e metadata, which must
+         * outlive the engine.  Without one the copies keep the mode they were created with.  Call
+         * before start().
+         */
+        void set_metadata(const MetadataCopier * metadata)
+        {
+            m_metadata = metadata;
+        }
+
+        /**
+         * @brief method to keep the copied data out of the page cache with @e mode; see FileCopier.
+         * Call before start().
+         */
+        void set_cache_mode(FileCopier::CacheMode mode)
+        {
+            m_cache_mode = mode;
+        }
+
+        /**
+         * @brief method to hold the workers to the limits of @e throttle, which must outlive the
+         * engine.  The limits may change while the copy runs.  Call before start().
+         */
+        void set_throttle(Throttle * throttle)
+        {
+            m_throttle = throttle;
+        }
+
+        /**
+         * @brief method to hash the data of every copied file with @e algorithm and keep the
+         * digests in checksums().  Hashing routes the data through userspace instead of the kernel
+         * copy paths.  Files skipped by sync mode or the journal are not hashed.  Call before start().
+         */
+        void set_verify(bool verify, ContentHasher::Algorithm algorithm)
+        {
+            m_verify = verify;
+            m_verify_algorithm = algorithm;
+        }
+
+        /**
+         * @brief method to set the size at which a file is split into ranges copied by several
+         * workers.  Zero turns splitting off.  Call before start().
+         */
+        void set_large_file_threshold(size_type bytes)
+        {
+            m_large_file_threshold = bytes;
+        }
+
+        /**
+         * @brief method to read ahead the next @e files queued files, so their data is on its way
+         * while the workers are still writing the files before them.  A prefetch thread asks the
+         * kernel for the start of each file or range with posix_fadvise(POSIX_FADV_WILLNEED).  Zero
+         * turns prefetching off.  It is also off in the Direct cache mode, which reads around the
+         * page cache, and in sync mode, which may skip the files it would read.  Call before start().
+         */
+        void set_prefetch_depth(size_type files);
+
+        /**
+         * @brief method to launch the worker threads.  Set the callbacks before calling start().
+         */
+        void start();
+
+        /**
+         * @brief method to queue a file for copying.
+         * @param job the file to copy.
+         * @return false if the engine stopped because of an error or an interruption, true otherwise.
+         */
+        auto submit(Job job) -> bool;
+
+        /**
+         * @brief method to wait for the queued jobs to finish and to stop the worker threads.
+         */
+        void finish();
+
+        [[nodiscard]] auto encountered_error() const -> bool
+        {
+            return m_encountered_error;
+        }
+
+        /**
+         * @return the checksums of the files copied with verification on.  Call after finish().
+         */
+        [[nodiscard]] auto checksums() const -> const std::vector<Checksum> &
+        {
+            return m_checksums;
+        }
+
+        [[nodiscard]] auto worker_count() const -> size_type
+        {
+            return m_worker_count;
+        }
+
+        /**
+         * @return the strategy for @e job.  Sparse files and cache modes other than Normal are never
+         * tiny, since the small path writes holes out and goes through the cache.
+         */
+        [[nodiscard]] auto size_class_of(const Job & job) const -> SizeClass;
+
+    private:
+        struct LargeFile;
+
+        struct Task
+        {
+            Job job{};
+            std::shared_ptr<LargeFile> large_file{};
+            size_type offset{0};
+            size_type length{0};
+            bool split{false}; // a huge file a worker still has to split into ranges
+        };
+
+        // A queued task as the prefetch thread sees it; sequence is its place in the queue order.
+        struct PrefetchItem
+        {
+            Job job{};
+            bool whole_file{true};
+            size_type offset{0};
+            size_type length{0};
+            size_type sequence{0};
+        };
+
+        size_type m_worker_count{1};
+        size_type m_queue_limit{1};
+        size_type m_next_job_id{0};
+        size_type m_large_file_threshold{0};
+        SyncMode m_sync_mode{SyncMode::Off};
+        CopyJournal * m_journal{nullptr};
+        PhaseTimings * m_timings{nullptr};
+        BufferPool * m_buffer_pool{nullptr};
+        FileCopier::CacheMode m_cache_mode{FileCopier::CacheMode::Normal};
+        Throttle * m_throttle{nullptr};
+        const MetadataCopier * m_metadata{nullptr};
+        bool m_verify{false};
+        ContentHasher::Algorithm m_verify_algorithm{ContentHasher::Algorithm::XXH3};
+
+        std::vector<Checksum> m_checksums{};
+        std::mutex m_checksums_mutex{};
+
+        std::vector<std::thread> m_workers{};
+        std::deque<Task> m_queue{};
+        std::mutex m_queue_mutex{};
+        std::condition_variable m_queue_has_work{};
+        std::condition_variable m_queue_has_room{};
+        bool m_finishing{false};
+        size_type m_splitting{0}; // workers splitting a huge file, which adds ranges to the queue
+        bool m_use_io_uring{false};
+
+        // The prefetch thread reads ahead the tasks numbered [m_dequeued, m_dequeued + m_prefetch_depth).
+        // Guarded by the queue mutex, like the counts.
+        size_type m_prefetch_depth{0};
+        bool m_prefetching{false};
+        std::thread m_prefetcher{};
+        std::deque<PrefetchItem> m_prefetch_queue{};
+        std::condition_variable m_prefetch_ready{};
+        size_type m_enqueued{0};
+        size_type m_dequeued{0};
+
+        std::atomic<bool> m_stopped{false};
+        std::atomic<bool> m_encountered_error{false};
+
+        progress_callback_type m_progress_callback{};
+        file_callback_type m_file_started_callback{};
+        file_callback_type m_file_finished_callback{};
+        file_callback_type m_file_skipped_callback{};
+        size_callback_type m_size_corrected_callback{};
+        error_callback_type m_error_callback{};
+        interrupter_type m_interrupter{};
+
+        auto enqueue(Task task) -> bool;
+
+        // Queues the ranges of a file without waiting for room.
+        void enqueue_ranges(std::vector<Task> & tasks);
+
+        // Appends @e task to the queue and the prefetch queue; the queue mutex must be held.
+        void push_task(Task task);
+
+        /**
+         * @brief method to split a huge file into ranges for the workers, unless the journal or sync
+         * mode finds it up to date.  Runs on a worker.
+         */
+        void split_large_file(const Job & job);
+
+        void worker_loop(size_type worker);
+
+        void prefetch_loop();
+
+        void prefetch(const PrefetchItem & item);
+
+        // The hasher belongs to the calling worker and is nullptr unless verifying.
+        void copy_job(const Job & job, ContentHasher * hasher);
+
+        void copy_batch(UringCopier & uring, std::vector<Job> & jobs, ContentHasher * hasher);
+
+        void copy_range(const Task & task, ContentHasher * hasher);
+
+        /**
+         * @brief method to copy the metadata of a large file whose ranges are all copied, close it
+         * and report it finished.
+         */
+        void complete_large_file(const Job & job, LargeFile & large_file);
+
+        void record_checksum(Checksum checksum);
+
+        // For files copied without a descriptor the engine can reach, the io_uring batches.
+        void apply_metadata_by_path(const Job & job);
+
+        /**
+         * @brief method to record a copied file and report it finished.  @e copied_bytes is the
+         * progress the file reported, which the size corrected callback gets if it is not
+         * Job::allocated_size.
+         */
+        void finish_job(const Job & job, size_type copied_bytes);
+
+        /**
+         * @return true if the journal recorded the job as finished, or if sync mode is on and the
+         * job's destination already matches its source.  In either case the skipped callback has
+         * been called.
+         */
+        auto skip_if_up_to_date(const Job & job) -> bool;
+
+        void report_error(const Job & job, const String & message);
+
+        // Waits until the throttle allows @e bytes and @e files more.
+        void throttle(size_type bytes, size_type files);
+
+        void stop();
+
+        [[nodiscard]] auto should_stop() const -> bool;
+    };
+
+} // namespace copy
+
+#endif // COPY_ENGINE_HPP
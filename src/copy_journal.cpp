@@ -0,0 +1,325 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "copy_journal.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        constexpr std::string_view journal_header{"tfcopy journal 1\n"};
+        constexpr std::string_view journal_suffix{".tfcopy-journal"};
+
+        constexpr char finished_record{'F'};
+        constexpr char range_record{'R'};
+
+        // Write the buffer once it holds this much, or once this long has passed since the last write.
+        constexpr std::string::size_type flush_size{64 * 1024};
+        constexpr std::chrono::seconds flush_interval{1};
+
+        // Parse one space-terminated decimal field and advance @e position past it.
+        template <typename T>
+        auto parse_field(std::string_view contents, std::string_view::size_type & position, T & value) -> bool
+        {
+            const auto * begin = contents.data() + position;
+            const auto * end = contents.data() + contents.size();
+            auto [next, error] = std::from_chars(begin, end, value);
+            if (error != std::errc{} || next == end || *next != ' ')
+            {
+                return false;
+            }
+            position += static_cast<std::string_view::size_type>(next - begin) + 1;
+            return true;
+        }
+    } // namespace
+
+    CopyJournal::CopyJournal(std::string journal_path, std::string destination_root) :
+        m_journal_path{std::move(journal_path)}, m_destination_root{std::move(destination_root)}
+    {}
+
+    CopyJournal::~CopyJournal()
+    {
+        flush();
+    }
+
+    auto CopyJournal::path_for_destination(const std::string & destination_path) -> std::string
+    {
+        auto path = destination_path;
+        while (path.size() > 1 && path.back() == '/')
+        {
+            path.pop_back();
+        }
+        return path + std::string{journal_suffix};
+    }
+
+    auto CopyJournal::load() -> bool
+    {
+        FileDescriptor file{::open(m_journal_path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (! file.is_valid())
+        {
+            return errno == ENOENT;
+        }
+
+        std::string contents{};
+        std::vector<char> buffer(1024 * 1024);
+        while (true)
+        {
+            const auto bytes_read = ::read(file.get(), buffer.data(), buffer.size());
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            contents.append(buffer.data(), static_cast<size_t>(bytes_read));
+        }
+
+        if (! contents.starts_with(journal_header))
+        {
+            return contents.empty();
+        }
+        parse(std::string_view{contents}.substr(journal_header.size()));
+        return true;
+    }
+
+    void CopyJournal::parse(std::string_view contents)
+    {
+        // Each record is "<type> <size> <modification time> <offset> <path length> <path>\n".
+        std::string_view::size_type position{0};
+        while (position + 2 < contents.size())
+        {
+            const auto type = contents[position];
+            if ((type != finished_record && type != range_record) || contents[position + 1] != ' ')
+            {
+                return;
+            }
+            position += 2;
+
+            size_type size{0};
+            int64_t modification_time{0};
+            size_type offset{0};
+            size_type path_length{0};
+            if (! parse_field(contents, position, size) || ! parse_field(contents, position, modification_time) ||
+                ! parse_field(contents, position, offset) || ! parse_field(contents, position, path_length))
+            {
+                return;
+            }
+            if (path_length >= contents.size() - position || contents[position + path_length] != '\n')
+            {
+                return;
+            }
+
+            auto & record = m_records[std::string{contents.substr(position, path_length)}];
+            position += path_length + 1;
+
+            // A later record for a file that changed replaces what was known about it.
+            if (record.size != size || record.modification_time != modification_time)
+            {
+                record = Record{size, modification_time};
+            }
+            if (type == finished_record)
+            {
+                record.finished = true;
+            }
+            else
+            {
+                record.ranges.push_back(offset);
+            }
+        }
+    }
+
+    auto CopyJournal::open(bool keep_records) -> bool
+    {
+        if (! keep_records)
+        {
+            m_records.clear();
+        }
+
+        const auto flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (keep_records ? 0 : O_TRUNC);
+        m_file.reset(::open(m_journal_path.c_str(), flags, 0644));
+        if (! m_file.is_valid())
+        {
+            return false;
+        }
+
+        struct stat status
+        {};
+        if (::fstat(m_file.get(), &status) == 0 && status.st_size == 0)
+        {
+            m_buffer.append(journal_header);
+        }
+        m_last_flush = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    auto CopyJournal::is_finished(std::string_view destination_path, size_type size,
+                                  int64_t modification_time) const -> bool
+    {
+        const auto * record = find(destination_path, size, modification_time);
+        return record != nullptr && record->finished;
+    }
+
+    auto CopyJournal::finished_ranges(std::string_view destination_path, size_type size,
+                                      int64_t modification_time) const -> std::vector<size_type>
+    {
+        const auto * record = find(destination_path, size, modification_time);
+        if (record == nullptr)
+        {
+            return {};
+        }
+        return record->ranges;
+    }
+
+    void CopyJournal::record_finished(std::string_view destination_path, size_type size, int64_t modification_time)
+    {
+        append(finished_record, destination_path, size, modification_time, 0);
+    }
+
+    void CopyJournal::record_range(std::string_view destination_path, size_type size, int64_t modification_time,
+                                   size_type offset)
+    {
+        append(range_record, destination_path, size, modification_time, offset);
+    }
+
+    void CopyJournal::flush()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        write_buffer();
+    }
+
+    void CopyJournal::remove()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_buffer.clear();
+        m_file.reset();
+        ::unlink(m_journal_path.c_str());
+    }
+
+    auto CopyJournal::relative_path(std::string_view destination_path) const -> std::string_view
+    {
+        if (destination_path.starts_with(m_destination_root))
+        {
+            destination_path.remove_prefix(m_destination_root.size());
+            while (! destination_path.empty() && destination_path.front() == '/')
+            {
+                destination_path.remove_prefix(1);
+            }
+        }
+        return destination_path;
+    }
+
+    auto CopyJournal::find(std::string_view destination_path, size_type size, int64_t modification_time) const
+        -> const Record *
+    {
+        if (m_records.empty())
+        {
+            return nullptr;
+        }
+
+        // The records are only read after load() and before the copy starts writing, so no lock.
+        const auto iterator = m_records.find(std::string{relative_path(destination_path)});
+        if (iterator == m_records.end() || iterator->second.size != size ||
+            iterator->second.modification_time != modification_time)
+        {
+            return nullptr;
+        }
+        return &iterator->second;
+    }
+
+    void CopyJournal::append(char type, std::string_view destination_path, size_type size, int64_t modification_time,
+                             size_type offset)
+    {
+        const auto path = relative_path(destination_path);
+
+        char fields[96]{};
+        auto * end = fields + sizeof(fields);
+        auto * next = fields;
+        *next++ = type;
+        for (const auto value : {static_cast<int64_t>(size), modification_time, static_cast<int64_t>(offset),
+                                 static_cast<int64_t>(path.size())})
+        {
+            *next++ = ' ';
+            next = std::to_chars(next, end, value).ptr;
+        }
+        *next++ = ' ';
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (! m_file.is_valid())
+        {
+            return;
+        }
+        m_buffer.append(fields, static_cast<std::string::size_type>(next - fields));
+        m_buffer.append(path);
+        m_buffer.push_back('\n');
+
+        if (m_buffer.size() >= flush_size || std::chrono::steady_clock::now() - m_last_flush >= flush_interval)
+        {
+            write_buffer();
+        }
+    }
+
+    void CopyJournal::write_buffer()
+    {
+        m_last_flush = std::chrono::steady_clock::now();
+        if (m_buffer.empty() || ! m_file.is_valid())
+        {
+            return;
+        }
+
+        std::string_view remaining{m_buffer};
+        while (! remaining.empty())
+        {
+            const auto written = ::write(m_file.get(), remaining.data(), remaining.size());
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // A journal that cannot be written only costs a longer resume; keep copying.
+                m_file.reset();
+                break;
+            }
+            remaining.remove_prefix(static_cast<std::string_view::size_type>(written));
+        }
+        m_buffer.clear();
+    }
+
+} // namespace copy
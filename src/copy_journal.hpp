@@ -0,0 +1,151 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef COPY_JOURNAL_HPP
+#define COPY_JOURNAL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "file_descriptor.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that records finished work in an append-only file next to the destination so an
+     * interrupted copy can be resumed.
+     *
+     * Every record names a file by its path relative to the destination root, with the size and
+     * modification time the scan saw.  A record is either a finished file or a finished range of a
+     * large file.  Records are buffered and written in blocks, so a record costs an append to a
+     * string rather than a system call.  Losing the unwritten tail of the journal is harmless; those
+     * files are copied again on the next run.  A torn record at the end of the file is ignored.
+     */
+    class CopyJournal
+    {
+    public:
+        using size_type = uint64_t;
+
+        /**
+         * @param journal_path the path of the journal file.
+         * @param destination_root the destination directory.  Destination paths are recorded
+         * relative to it so the journal does not depend on how the destination was spelled.
+         */
+        CopyJournal(std::string journal_path, std::string destination_root);
+
+        CopyJournal(const CopyJournal &) = delete;
+
+        CopyJournal & operator=(const CopyJournal &) = delete;
+
+        ~CopyJournal();
+
+        /**
+         * @return the path of the journal kept for @e destination_path.
+         */
+        [[nodiscard]] static auto path_for_destination(const std::string & destination_path) -> std::string;
+
+        /**
+         * @brief method to read the records of an earlier run.  A missing journal is not an error.
+         * @return false if the journal exists but could not be read.
+         */
+        auto load() -> bool;
+
+        /**
+         * @brief method to open the journal for appending.
+         * @param keep_records true to add to the records of an earlier run, false to start over.
+         * @return false if the journal could not be opened.
+         */
+        auto open(bool keep_records) -> bool;
+
+        /**
+         * @return true if an earlier run finished the file at @e destination_path and the source
+         * has not changed since.
+         */
+        [[nodiscard]] auto is_finished(std::string_view destination_path, size_type size,
+                                       int64_t modification_time) const -> bool;
+
+        /**
+         * @return the offsets of the ranges an earlier run finished for the file at
+         * @e destination_path, or nothing if the source has changed since.
+         */
+        [[nodiscard]] auto finished_ranges(std::string_view destination_path, size_type size,
+                                           int64_t modification_time) const -> std::vector<size_type>;
+
+        void record_finished(std::string_view destination_path, size_type size, int64_t modification_time);
+
+        void record_range(std::string_view destination_path, size_type size, int64_t modification_time,
+                          size_type offset);
+
+        /**
+         * @brief method to write the buffered records.
+         */
+        void flush();
+
+        /**
+         * @brief method to delete the journal once the copy completed.
+         */
+        void remove();
+
+    private:
+        struct Record
+        {
+            size_type size{0};
+            int64_t modification_time{0};
+            bool finished{false};
+            std::vector<size_type> ranges{};
+        };
+
+        std::string m_journal_path{};
+        std::string m_destination_root{};
+        std::unordered_map<std::string, Record> m_records{};
+
+        FileDescriptor m_file{};
+        std::string m_buffer{};
+        std::chrono::steady_clock::time_point m_last_flush{};
+        std::mutex m_mutex{};
+
+        [[nodiscard]] auto relative_path(std::string_view destination_path) const -> std::string_view;
+
+        [[nodiscard]] auto find(std::string_view destination_path, size_type size, int64_t modification_time) const
+            -> const Record *;
+
+        void append(char type, std::string_view destination_path, size_type size, int64_t modification_time,
+                    size_type offset);
+
+        void parse(std::string_view contents);
+
+        void write_buffer();
+    };
+
+} // namespace copy
+
+#endif // COPY_JOURNAL_HPP
@@ -0,0 +1,640 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "copy_operation.hpp"
+#include "content_verifier.hpp"
+#include "copy_journal.hpp"
+#include "copy_scheduler.hpp"
+#include "file_copier.hpp"
+#include "tree_scanner.hpp"
+
+namespace copy
+{
+
+    CopyOperation::CopyOperation(DataModel & model) : m_model{model} {}
+
+    auto CopyOperation::scan() -> bool
+    {
+        bool result{false};
+
+        if (m_file_manager.fileExistsAtPath(m_model.source_path))
+        {
+            const auto source_path = m_model.source_path.stlStringInUTF8();
+            if (auto entry = m_model.inventory.add_item_at_path(source_path, source_path.size()))
+            {
+                m_model.total_files = 1;
+                m_model.total_bytes = entry->allocated_size;
+                result = true;
+            }
+        }
+        else if (m_file_manager.directoryExistsAtPath(m_model.source_path))
+        {
+            TreeScanner scanner{m_model.inventory, m_model.copy_jobs};
+            scanner.set_entry_callback([this](const FileInventory::Entry & entry) {
+                // Only count regular files; FIFOs, sockets and devices are skipped by the copy.
+                if (entry.type != FileInventory::EntryType::File)
+                {
+                    return;
+                }
+                // The holes of sparse files are not copied, so they do not count toward the work.  A
+                // file whose copy comes to a different amount corrects the total when it finishes.
+                m_model.total_bytes += entry.allocated_size;
+                m_model.total_files += 1;
+            });
+            scanner.set_interrupter([this]() -> bool {
+                return is_interrupted();
+            });
+            scanner.set_timings(&m_model.timings);
+            scanner.set_follow_links(! m_model.preserve);
+
+            result = scanner.scan(m_model.source_path.stlStringInUTF8());
+            if (! result)
+            {
+                LOG(LogPriority::Warning, "Scan of " + m_model.source_path + " did not complete")
+            }
+        }
+
+        if (! result && ! is_interrupted())
+        {
+            m_model.scan_failed = true;
+        }
+        m_model.inventory.mark_complete();
+        m_model.scan_complete = true;
+        return result;
+    }
+
+    auto CopyOperation::copy() -> bool
+    {
+        LOG(LogPriority::Info, "source path %@ destination path %@", m_model.source_path, m_model.destination_path)
+
+        configure_buffers();
+        // Syncing compares modification times, so the copies need the source's.
+        m_metadata = MetadataCopier{MetadataCopier::Attributes{m_model.preserve || m_model.sync, m_model.preserve,
+                                                               m_model.preserve}};
+        if (m_model.cache_mode != FileCopier::CacheMode::Normal)
+        {
+            const String mode_name{FileCopier::cache_mode_name(m_model.cache_mode)};
+            LOG(LogPriority::Info, "Page cache mode %@", mode_name)
+        }
+
+        bool result{false};
+        if (m_file_manager.fileExistsAtPath(m_model.source_path))
+        {
+            result = copy_file();
+        }
+        else if (m_file_manager.directoryExistsAtPath(m_model.source_path))
+        {
+            result = copy_directory();
+        }
+        else
+        {
+            LOG(LogPriority::Info, "Did not catch a valid case")
+            return false;
+        }
+
+        LOG(LogPriority::Info,
+            String::initWithFormat("Finished with %u KiB buffers", m_model.buffer_pool.current_size() / 1024))
+        LOG(LogPriority::Info, "Phase timings:\n" + String{m_model.timings.report().c_str()})
+        return result;
+    }
+
+    auto CopyOperation::copy_file() -> bool
+    {
+        if (m_file_manager.directoryExistsAtPath(m_model.destination_path))
+        {
+            auto base_name = m_file_manager.baseNameOfItemAtPath(m_model.source_path);
+            m_model.destination_path += FileManager::pathSeparator + base_name;
+        }
+
+        FileInventory::Entry entry{};
+        std::string relative_path{};
+        m_model.inventory.wait_for_entry(0, entry, relative_path);
+
+        const CopyEngine::Job job{m_model.source_path, m_model.destination_path, entry.size, entry.allocated_size,
+                                  entry.mode, entry.modification_time, 1};
+
+        if (m_file_started_callback)
+        {
+            m_file_started_callback(job);
+        }
+
+        size_type copied_bytes{0};
+        auto notifier = ItemCopier::notifier_type{[this, &job, &copied_bytes](auto & size) {
+            copied_bytes += size;
+            if (m_progress_callback)
+            {
+                m_progress_callback(job, size);
+            }
+            m_model.throttle.wait(size, 0, [this]() -> bool {
+                return is_interrupted();
+            });
+        }};
+
+        std::unique_ptr<ContentHasher> hasher{};
+        try
+        {
+            FileCopier copier{job.source_path, job.destination_path};
+            copier.set_notifier(notifier);
+            copier.set_interrupter([this]() -> bool {
+                return is_interrupted();
+            });
+            copier.set_timings(&m_model.timings);
+            copier.set_buffer_pool(&m_model.buffer_pool);
+            copier.set_cache_mode(m_model.cache_mode);
+            copier.set_metadata(&m_metadata);
+            if (m_model.verify)
+            {
+                hasher = std::make_unique<ContentHasher>(m_model.verify_algorithm);
+                copier.set_hasher(hasher.get());
+            }
+            copier.copy();
+        }
+        catch (std::exception & e)
+        {
+            report_error("Error copying " + job.source_path + " to " + job.destination_path + ": " + e.what());
+            return false;
+        }
+
+        if (copied_bytes != job.allocated_size)
+        {
+            correct_total(job, copied_bytes);
+        }
+        if (m_file_finished_callback)
+        {
+            m_file_finished_callback(job);
+        }
+
+        if (hasher && ! is_interrupted())
+        {
+            const std::vector<CopyEngine::Checksum> checksums{
+                CopyEngine::Checksum{job.destination_path, true, 0, entry.size, hasher->digest()}};
+            return verify(checksums, m_file_manager.dirNameOfItemAtPath(job.destination_path).stlStringInUTF8());
+        }
+        return ! is_interrupted();
+    }
+
+    auto CopyOperation::copy_directory() -> bool
+    {
+        if (m_file_manager.fileExistsAtPath(m_model.destination_path))
+        {
+            report_error(String::initWithFormat("cannot overwrite non-directory '%@' with directory '%@'",
+                                                &m_model.destination_path, &m_model.source_path));
+            return false;
+        }
+
+        // The scan leaves the root out of the inventory, so its directory is made and deferred here.
+        if (! ensure_directory(m_model.destination_path.stlStringInUTF8()))
+        {
+            return false;
+        }
+        m_metadata.defer_directory(m_model.source_path.stlStringInUTF8(), m_model.destination_path.stlStringInUTF8());
+
+        // The journal records finished work so an interrupted copy can be resumed with --resume.
+        const auto destination_root = m_model.destination_path.stlStringInUTF8();
+        CopyJournal journal{CopyJournal::path_for_destination(destination_root), destination_root};
+        if (m_model.resume && ! journal.load())
+        {
+            LOG(LogPriority::Warning, "Unable to read the journal, copying everything")
+        }
+        const auto journal_is_open = journal.open(m_model.resume);
+        if (! journal_is_open)
+        {
+            LOG(LogPriority::Warning, "Unable to open the journal, this copy cannot be resumed")
+        }
+
+        CopyEngine engine{m_model.copy_jobs};
+        engine.set_progress_callback(m_progress_callback);
+        engine.set_file_started_callback(m_file_started_callback);
+        engine.set_file_finished_callback(m_file_finished_callback);
+        engine.set_file_skipped_callback(m_file_skipped_callback);
+        engine.set_size_corrected_callback([this](auto & job, auto copied_bytes) {
+            correct_total(job, copied_bytes);
+        });
+        engine.set_error_callback([this](auto & job, auto & message) {
+            report_error("Error copying " + job.source_path + " to " + job.destination_path + ": " + message);
+        });
+        engine.set_interrupter([this]() -> bool {
+            return is_interrupted();
+        });
+
+        engine.set_use_io_uring(m_model.use_io_uring);
+        engine.set_large_file_threshold(m_model.large_file_threshold);
+        engine.set_timings(&m_model.timings);
+        engine.set_buffer_pool(&m_model.buffer_pool);
+        engine.set_cache_mode(m_model.cache_mode);
+        engine.set_prefetch_depth(m_model.prefetch_files);
+        engine.set_throttle(&m_model.throttle);
+        engine.set_metadata(&m_metadata);
+        engine.set_verify(m_model.verify, m_model.verify_algorithm);
+        if (m_model.sync)
+        {
+            engine.set_sync_mode(m_model.sync_by_content ? CopyEngine::SyncMode::Content
+                                                         : CopyEngine::SyncMode::SizeAndTime);
+        }
+        if (journal_is_open)
+        {
+            engine.set_journal(&journal);
+        }
+        engine.start();
+
+        if (m_model.dedup != DuplicateFinder::Mode::Off)
+        {
+            // Groups need every file of a size, so this waits for the scan to finish.
+            DuplicateFinder finder{m_model.verify_algorithm, m_model.copy_jobs};
+            finder.set_interrupter([this]() -> bool {
+                return is_interrupted();
+            });
+            m_duplicates = finder.find(m_model.inventory, m_model.source_path.stlStringInUTF8());
+            LOG(LogPriority::Info,
+                String::initWithFormat("Found %u files with duplicated contents", m_duplicates.size()))
+        }
+
+        m_paths = PathBuilder{m_model.source_path.stlStringInUTF8(), m_model.destination_path.stlStringInUTF8(),
+                              m_model.fix_problematic_file_paths};
+
+        // On a spinning disk the files go to the engine in windows sorted by where they are on the
+        // disk.  Directories and links are still made as they come, so a file's directory exists first.
+        // A streaming copy hands a window over whenever it would otherwise wait for the scan, so it
+        // keeps copying while the scan runs instead of holding everything until the scan ends.
+        const auto source_root = m_model.source_path.stlStringInUTF8();
+        CopyScheduler scheduler{CopyScheduler::order_for(m_model.copy_order, source_root), source_root};
+        const auto reorder = scheduler.order() != CopyScheduler::Order::Scan;
+        if (reorder)
+        {
+            const String order_name{CopyScheduler::order_name(scheduler.order())};
+            LOG(LogPriority::Info, "Copying files in %@ order", order_name)
+        }
+        auto copy_scheduled = [this, &engine, &scheduler]() -> bool {
+            for (const auto & item : scheduler.take())
+            {
+                m_paths.set_item(item.relative_path);
+                if (! copy_entry(engine, item.entry))
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        // The scan recorded every item once; run the copy from that record instead of walking and
+        // stat'ing the source again.  In streaming mode this waits for the scan to catch up.
+        bool encountered_error{false};
+        FileInventory::Entry entry{};
+        std::string relative_path{};
+        for (FileInventory::index_type index = 0;; index++)
+        {
+            if (reorder && ! scheduler.empty() && m_model.inventory.would_wait_for(index) && ! copy_scheduled())
+            {
+                encountered_error = ! is_interrupted();
+                break;
+            }
+            if (! m_model.inventory.wait_for_entry(index, entry, relative_path))
+            {
+                break;
+            }
+
+            auto copied = true;
+            if (reorder && entry.type == FileInventory::EntryType::File)
+            {
+                scheduler.add(entry, relative_path);
+                copied = ! scheduler.is_full() || copy_scheduled();
+            }
+            else
+            {
+                m_paths.set_item(relative_path);
+                copied = copy_entry(engine, entry);
+            }
+            if (! copied)
+            {
+                encountered_error = ! is_interrupted();
+                break;
+            }
+        }
+        if (! encountered_error && ! is_interrupted() && ! scheduler.empty() && ! copy_scheduled())
+        {
+            encountered_error = ! is_interrupted();
+        }
+
+        engine.finish();
+
+        if (encountered_error || engine.encountered_error() || is_interrupted())
+        {
+            journal.flush();
+            return false;
+        }
+
+        // Every file the links point to is complete now.  The first name of a hard linked file may
+        // itself be a duplicate, so the duplicates go first.
+        auto on_link_error = [this](const std::string & message) {
+            report_error(String{message.c_str()});
+        };
+        m_hard_links.set_interrupter([this]() -> bool {
+            return is_interrupted();
+        });
+        m_duplicate_links.set_interrupter([this]() -> bool {
+            return is_interrupted();
+        });
+        const auto link_failures = m_duplicate_links.create_links(m_metadata, on_link_error) +
+                                   m_hard_links.create_links(m_metadata, on_link_error);
+        if (link_failures > 0 || is_interrupted())
+        {
+            journal.flush();
+            return false;
+        }
+
+        // Nothing is written into the directories any more, so their times and modes can be set.
+        {
+            PhaseTimings::Timer timer{&m_model.timings, PhaseTimings::Phase::Chmod};
+            m_metadata.apply_to_directories();
+        }
+
+        // Whatever the scan could not read was not copied either.  Keep the journal so a later run
+        // can resume once the problem is fixed.
+        if (m_model.scan_failed)
+        {
+            report_error("Some of " + m_model.source_path + " could not be read and was not copied");
+            journal.flush();
+            return false;
+        }
+
+        journal.remove();
+
+        if (m_model.verify)
+        {
+            return verify(engine.checksums(), destination_root);
+        }
+        return true;
+    }
+
+    auto CopyOperation::copy_entry(CopyEngine & engine, const FileInventory::Entry & entry) -> bool
+    {
+        const auto & source_path = m_paths.source();
+        const auto & destination_path = m_paths.destination();
+
+        if (entry.type == FileInventory::EntryType::Other)
+        {
+            // Reading a FIFO or a device could block or never end, so only regular files are copied.
+            LOG(LogPriority::Warning, "Skipping " + String{source_path.c_str()} + ", which is not a regular file")
+            return true;
+        }
+
+        if (entry.type == FileInventory::EntryType::Directory)
+        {
+            if (! ensure_directory(destination_path))
+            {
+                return false;
+            }
+            m_metadata.defer_directory(source_path, destination_path);
+            return true;
+        }
+
+        // The scan adds a directory before its contents, so this is nearly always a cache hit.
+        if (! ensure_directory(m_paths.destination_directory()))
+        {
+            return false;
+        }
+
+        if (entry.type == FileInventory::EntryType::Symlink)
+        {
+            return copy_symlink(source_path, destination_path, entry);
+        }
+
+        if (link_to_earlier_copy(source_path, destination_path, entry))
+        {
+            return true;
+        }
+
+        return engine.submit(CopyEngine::Job{String{source_path.c_str()}, String{destination_path.c_str()}, entry.size,
+                                             entry.allocated_size, entry.mode, entry.modification_time});
+    }
+
+    auto CopyOperation::ensure_directory(std::string_view path) -> bool
+    {
+        PhaseTimings::Timer timer{&m_model.timings, PhaseTimings::Phase::Mkdir};
+        if (const auto error = m_directories.ensure(path); error != 0)
+        {
+            report_error("Error creating directory: " + String{std::string{path}.c_str()} + ": " +
+                         std::strerror(error));
+            return false;
+        }
+        return true;
+    }
+
+    auto CopyOperation::link_to_earlier_copy(const std::string & source_path, const std::string & destination_path,
+                                             const FileInventory::Entry & entry) -> bool
+    {
+        const auto identity = FileInventory::identity_of(entry);
+
+        LinkTracker * tracker{nullptr};
+        const std::string * target{nullptr};
+        auto method = LinkTracker::Method::Hard;
+        if (m_model.hard_links && entry.link_count > 1)
+        {
+            tracker = &m_hard_links;
+            target = m_hard_links.earlier_copy(identity, destination_path);
+        }
+        if (auto duplicate = m_duplicates.find(identity); ! target && duplicate != m_duplicates.end())
+        {
+            tracker = &m_duplicate_links;
+            target = m_duplicate_links.earlier_copy(duplicate->second, destination_path);
+            if (m_model.dedup == DuplicateFinder::Mode::Reflink)
+            {
+                method = LinkTracker::Method::Clone;
+            }
+        }
+        if (! target)
+        {
+            return false;
+        }
+
+        tracker->defer_link(method, source_path, *target, destination_path);
+        m_model.total_files -= 1;
+        m_model.total_bytes -= entry.allocated_size;
+        return true;
+    }
+
+    auto CopyOperation::copy_symlink(const std::string & source_path, const std::string & destination_path,
+                                     const FileInventory::Entry & entry) -> bool
+    {
+
+        auto read_link = [](const std::string & path, size_type size_hint) -> std::optional<std::string> {
+            // The size from lstat is a hint; the link may have changed since.
+            std::string target(std::max<size_type>(size_hint, 64), '\0');
+            while (true)
+            {
+                const auto length = ::readlink(path.c_str(), target.data(), target.size());
+                if (length < 0)
+                {
+                    return std::nullopt;
+                }
+                if (static_cast<size_t>(length) < target.size())
+                {
+                    target.resize(static_cast<size_t>(length));
+                    return target;
+                }
+                target.resize(target.size() * 2);
+            }
+        };
+
+        const auto target = read_link(source_path, entry.size + 1);
+        if (! target)
+        {
+            report_error("Error reading link " + String{source_path.c_str()} + ": " + std::strerror(errno));
+            return false;
+        }
+
+        if (::symlink(target->c_str(), destination_path.c_str()) != 0)
+        {
+            // A resumed or synced copy finds the link already there.  Anything else in its place is
+            // replaced, as it would be for a file.
+            auto error = errno;
+            if (error == EEXIST && read_link(destination_path, target->size() + 1) != target)
+            {
+                ::unlink(destination_path.c_str());
+                error = ::symlink(target->c_str(), destination_path.c_str()) == 0 ? 0 : errno;
+            }
+            else if (error == EEXIST)
+            {
+                error = 0;
+            }
+            if (error != 0)
+            {
+                report_error("Error creating link " + String{destination_path.c_str()} + ": " + std::strerror(error));
+                return false;
+            }
+        }
+
+        struct stat status
+        {};
+        if (::lstat(source_path.c_str(), &status) == 0)
+        {
+            PhaseTimings::Timer timer{&m_model.timings, PhaseTimings::Phase::Chmod};
+            m_metadata.apply(source_path, destination_path, status);
+        }
+        return true;
+    }
+
+    auto CopyOperation::verify(const std::vector<CopyEngine::Checksum> & checksums,
+                               const std::string & destination_root) -> bool
+    {
+        m_model.verifying = true;
+        const String algorithm_name{ContentHasher::name_of(m_model.verify_algorithm)};
+        LOG(LogPriority::Info,
+            String::initWithFormat("Verifying %u copied files and ranges with %@", checksums.size(), &algorithm_name))
+
+        ContentVerifier verifier{m_model.verify_algorithm, m_model.copy_jobs};
+        verifier.set_mismatch_callback([this](auto & checksum, auto & reason) {
+            auto message = "Verification failed for " + checksum.destination_path;
+            if (! checksum.whole_file)
+            {
+                message += String::initWithFormat(" at offset %u", checksum.offset);
+            }
+            message += ": " + reason;
+
+            LOG(LogPriority::Critical, message)
+            if (m_mismatch_callback)
+            {
+                m_mismatch_callback(message);
+            }
+        });
+        verifier.set_interrupter([this]() -> bool {
+            return is_interrupted();
+        });
+
+        const auto mismatches = verifier.verify(checksums, destination_root);
+        m_model.verifying = false;
+
+        if (is_interrupted())
+        {
+            LOG(LogPriority::Warning, "Verification was interrupted")
+            return false;
+        }
+        if (mismatches > 0)
+        {
+            LOG(LogPriority::Critical, String::initWithFormat("Verification found %u mismatches", mismatches))
+            return false;
+        }
+        LOG(LogPriority::Info, "Verification found no mismatches")
+        return true;
+    }
+
+    void CopyOperation::configure_buffers()
+    {
+        if (m_model.buffer_size > 0)
+        {
+            m_model.buffer_pool.set_fixed_size(m_model.buffer_size);
+            return;
+        }
+
+        // The destination may not exist yet; its parent is on the same file system.
+        struct stat source_status
+        {};
+        struct stat destination_status
+        {};
+        const auto source_path = m_model.source_path.stlStringInUTF8();
+        auto destination_path = m_model.destination_path.stlStringInUTF8();
+        if (::stat(destination_path.c_str(), &destination_status) != 0)
+        {
+            destination_path = m_file_manager.dirNameOfItemAtPath(m_model.destination_path).stlStringInUTF8();
+            ::stat(destination_path.c_str(), &destination_status);
+        }
+        ::stat(source_path.c_str(), &source_status);
+
+        const auto block_size = std::max(source_status.st_blksize, destination_status.st_blksize);
+        m_model.buffer_pool.seed(static_cast<size_type>(block_size));
+        LOG(LogPriority::Info,
+            String::initWithFormat("Starting with %u KiB buffers", m_model.buffer_pool.current_size() / 1024))
+    }
+
+    void CopyOperation::correct_total(const CopyEngine::Job & job, size_type copied_bytes)
+    {
+        // Added before subtracting, so the total never wraps below zero on the way.
+        m_model.total_bytes += copied_bytes;
+        m_model.total_bytes -= job.allocated_size;
+    }
+
+    void CopyOperation::report_error(const String & message)
+    {
+        LOG(LogPriority::Critical, message)
+        if (m_error_callback)
+        {
+            m_error_callback(message);
+        }
+    }
+
+    auto CopyOperation::is_interrupted() const -> bool
+    {
+        return m_interrupter && m_interrupter();
+    }
+
+} // namespace copy
@@ -0,0 +1,203 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef COPY_OPERATION_HPP
+#define COPY_OPERATION_HPP
+
+#include <functional>
+#include "TFFoundation.hpp"
+#include "copy_engine.hpp"
+#include "data_model.hpp"
+#include "directory_cache.hpp"
+#include "duplicate_finder.hpp"
+#include "link_tracker.hpp"
+#include "metadata_copier.hpp"
+#include "path_builder.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    /**
+     * @brief class that runs the scan and the copy described by a DataModel without any UI.
+     *
+     * The panels and the headless mode both drive a copy through this class and differ only in
+     * what they do with the callbacks.  scan() fills the model's inventory and totals; copy() copies
+     * from the inventory, so the two can run at the same time on different threads (see
+     * DataModel::stream_copy).  A single file is reported as one job with id 1.
+     *
+     * With DataModel::verify set, copy() ends with a verify stage that reads the copied files back
+     * and compares them with the digests taken while copying.
+     */
+    class CopyOperation
+    {
+    public:
+        using size_type = CopyEngine::size_type;
+        using message_callback_type = std::function<void(const String & message)>;
+
+        explicit CopyOperation(DataModel & model);
+
+        void set_progress_callback(CopyEngine::progress_callback_type callback)
+        {
+            m_progress_callback = std::move(callback);
+        }
+
+        void set_file_started_callback(CopyEngine::file_callback_type callback)
+        {
+            m_file_started_callback = std::move(callback);
+        }
+
+        void set_file_finished_callback(CopyEngine::file_callback_type callback)
+        {
+            m_file_finished_callback = std::move(callback);
+        }
+
+        void set_file_skipped_callback(CopyEngine::file_callback_type callback)
+        {
+            m_file_skipped_callback = std::move(callback);
+        }
+
+        /**
+         * @brief method to set the callback that receives a readable message for every error.  The
+         * error has already been logged.
+         */
+        void set_error_callback(message_callback_type callback)
+        {
+            m_error_callback = std::move(callback);
+        }
+
+        /**
+         * @brief method to set the callback that receives a readable message for every file the
+         * verify stage finds different.  It has already been logged.  The callback is called from
+         * several threads at once.
+         */
+        void set_mismatch_callback(message_callback_type callback)
+        {
+            m_mismatch_callback = std::move(callback);
+        }
+
+        void set_interrupter(CopyEngine::interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to scan the source into the model's inventory, updating the model's totals
+         * as it goes.  Marks the scan complete when done, even on failure, so copy() never waits
+         * forever.
+         * @return false if the scan failed or was interrupted.
+         */
+        auto scan() -> bool;
+
+        /**
+         * @brief method to copy the items in the model's inventory.  Blocks until the copy finishes.
+         * @return true if everything was copied without errors or an interruption.
+         */
+        auto copy() -> bool;
+
+    private:
+        DataModel & m_model;
+        FileManager m_file_manager{};
+
+        CopyEngine::progress_callback_type m_progress_callback{};
+        CopyEngine::file_callback_type m_file_started_callback{};
+        CopyEngine::file_callback_type m_file_finished_callback{};
+        CopyEngine::file_callback_type m_file_skipped_callback{};
+        message_callback_type m_error_callback{};
+        message_callback_type m_mismatch_callback{};
+        CopyEngine::interrupter_type m_interrupter{};
+        MetadataCopier m_metadata{};
+        DirectoryCache m_directories{};
+        PathBuilder m_paths{};
+
+        // Copies that later names of a hard linked file, and later duplicates, are linked to.
+        LinkTracker m_hard_links{};
+        LinkTracker m_duplicate_links{};
+        DuplicateFinder::result_type m_duplicates{};
+
+        auto copy_file() -> bool;
+
+        auto copy_directory() -> bool;
+
+        /**
+         * @brief method to create the destination of one inventory entry, for a directory, or to
+         * submit its copy to @e engine.  The entry's paths are in m_paths.
+         * @return false if the copy should stop.
+         */
+        auto copy_entry(CopyEngine & engine, const FileInventory::Entry & entry) -> bool;
+
+        /**
+         * @brief method to create the destination directory @e path and its parents, once per run.
+         * @return false, after reporting the error, if it could not be created.
+         */
+        auto ensure_directory(std::string_view path) -> bool;
+
+        /**
+         * @brief method to defer a link to an earlier copy, if @e entry is another name of a file
+         * already copied or, with DataModel::dedup set, a duplicate of one.  The entry then no
+         * longer counts toward the totals.
+         * @return true if the entry is linked instead of copied.
+         */
+        auto link_to_earlier_copy(const std::string & source_path, const std::string & destination_path,
+                                  const FileInventory::Entry & entry) -> bool;
+
+        /**
+         * @brief method to recreate the symbolic link at @e source as @e destination, pointing at
+         * the same target, and copy its metadata.
+         * @return false if the copy should stop.
+         */
+        auto copy_symlink(const std::string & source_path, const std::string & destination_path,
+                          const FileInventory::Entry & entry) -> bool;
+
+        /**
+         * @brief method to read back the destinations of @e checksums and compare them.
+         * @return true if every file matched and the check was not interrupted.
+         */
+        auto verify(const std::vector<CopyEngine::Checksum> & checksums, const std::string & destination_root)
+            -> bool;
+
+        /**
+         * @brief method to size the buffer pool: the fixed size if one was given, otherwise a start
+         * from the preferred I/O size of the source and destination file systems.
+         */
+        void configure_buffers();
+
+        /**
+         * @brief method to move the total by the difference between the bytes a finished file
+         * reported and its Job::allocated_size, the share the scan counted for it.
+         */
+        void correct_total(const CopyEngine::Job & job, size_type copied_bytes);
+
+        void report_error(const String & message);
+
+        [[nodiscard]] auto is_interrupted() const -> bool;
+    };
+
+} // namespace copy
+
+#endif // COPY_OPERATION_HPP
@@ -25,39 +25,74 @@
 *
 * ******************************************************************************/
 
+#include <algorithm>
 #include <functional>
 #include "copy_panel.hpp"
+#include "copy_operation.hpp"
 #include "utilities.hpp"
 
 namespace copy
 {
 
-    CopyPanel::CopyPanel(screen_type & screen, model_type & model) : BasePanel(screen, model)
+    namespace
     {
-        m_progress_meter.set_callback([this](auto percentage) {
-            // percentage should be an integer between 0-100 inclusive.
-            m_percent_files_copied = static_cast<decltype(m_percent_files_copied)>(percentage) / 100;
-            m_screen.PostEvent(Event::Custom);
-        });
-
-        m_current_file_progress_meter.set_callback([this](auto percentage) {
-            // percentage should be an integer between 0-100 inclusive.
-            m_percent_current_file_copied = static_cast<decltype(m_percent_current_file_copied)>(percentage) / 100;
-            m_screen.PostEvent(Event::Custom);
-        });
-
-        m_file_progress_notifier.set_callback([this](auto & amount) {
-            m_current_files += amount;
-        });
-
-        m_buttons = Container::Horizontal({Button(
+        // Render() pulls the counters at this rate; nothing on the copy path posts events.
+        constexpr auto refresh_interval = std::chrono::milliseconds(1000 / 15);
+
+        // The panel lists this many mismatches and counts the rest; all of them are in the log.
+        constexpr size_t mismatches_shown{8};
+
+        // The rate shown follows roughly the last few seconds, so a changed limit shows up quickly.
+        constexpr double rate_smoothing_seconds{3.0};
+        constexpr double rate_sample_seconds{0.25};
+
+        // Slower never takes the limit below this.
+        constexpr CopyPanel::size_type minimum_bytes_per_second{256 * 1024};
+    } // namespace
+
+    CopyPanel::CopyPanel(screen_type & screen, model_type & model) :
+        BasePanel(screen, model), m_progress{model.copy_jobs + 1}
+    {
+        auto stats_button = Button(
+            "Stats",
+            [this] {
+                m_show_timings = ! m_show_timings;
+            },
+            m_model.button_style);
+
+        auto slower_button = Button(
+            "Slower",
+            [this] {
+                change_limits(0.5);
+            },
+            m_model.button_style);
+
+        auto faster_button = Button(
+            "Faster",
+            [this] {
+                change_limits(2.0);
+            },
+            m_model.button_style);
+
+        auto unlimited_button = Button(
+            "No limit",
+            [this] {
+                m_model.throttle.set_bytes_per_second(0);
+                m_model.throttle.set_files_per_second(0);
+            },
+            m_model.button_style);
+
+        auto exit_button = Button(
             "Exit",
             [this] {
                 m_interrupted = true;
                 auto closure = m_screen.ExitLoopClosure();
                 closure();
             },
-            m_model.button_style)});
+            m_model.button_style);
+
+        m_buttons =
+            Container::Horizontal({slower_button, faster_button, unlimited_button, stats_button, exit_button});
 
         this->Add(Container::Vertical({m_buttons}));
     }
@@ -67,35 +102,119 @@ namespace copy
         std::lock_guard<std::mutex> lock(m_progress_message_mutex);
         const auto duration = duration_cast<std::chrono::milliseconds>(SystemDate{} - m_start_copy_time);
 
-        m_bytes_per_second = m_bytes_copied / (static_cast<double>(duration.count()) / 1000);
+        const auto progress = m_progress.totals();
+        const auto bytes_copied = static_cast<double>(progress.bytes_copied);
+        const auto bytes_skipped = static_cast<double>(progress.bytes_skipped);
+        update_rate(bytes_copied);
+
+        // A streaming scan grows the total while the copy runs.  Keep it at least as large as what is
+        // done so the gauge never passes 100%.
+        const auto total_bytes =
+            std::max(static_cast<double>(m_model.total_bytes.load()), bytes_copied + bytes_skipped);
+        const auto percent_files_copied =
+            total_bytes > 0 ? static_cast<float>((bytes_copied + bytes_skipped) / total_bytes)
+                            : (m_copy_thread_finished ? 1.0f : 0.0f);
+
+        const auto current_file_size = m_current_file_size.load();
+        const auto percent_current_file_copied =
+            current_file_size > 0 ? std::min(static_cast<float>(static_cast<double>(m_current_file_bytes.load()) /
+                                                                static_cast<double>(current_file_size)),
+                                             1.0f)
+                                  : (m_current_file_id > 0 ? 1.0f : 0.0f);
 
         const auto duration_text = m_duration_formatter.string_from_duration(duration);
-        const auto text_for_file_progress = String::initWithFormat("%u/%u files", m_current_files, m_model.total_files);
+        // While a streaming scan is running the totals are lower bounds, so say so.
+        const auto scan_complete = m_model.scan_complete.load();
+        const auto text_for_file_progress =
+            String::initWithFormat(scan_complete ? "%u/%u files" : "%u/%u+ files",
+                                   progress.files_copied + progress.files_skipped, m_model.total_files.load());
         const auto formatted_bytes_per_second = format_total_bytes(m_bytes_per_second);
         const auto text_for_copy_rate = String::initWithFormat("%@/sec", &formatted_bytes_per_second);
 
-        const auto remaining_time = static_cast<double>(m_model.bytes_remaining) / m_bytes_per_second;
+        const auto show_limit = m_model.throttle.is_limited();
+        const auto bytes_limit = m_model.throttle.bytes_per_second();
+        const auto files_limit = m_model.throttle.files_per_second();
+        const auto formatted_bytes_limit = format_total_bytes(static_cast<double>(bytes_limit));
+        auto text_for_limit = bytes_limit > 0 ? String::initWithFormat("limit: %@/sec", &formatted_bytes_limit)
+                                              : String{"limit:"};
+        if (files_limit > 0)
+        {
+            const auto format = bytes_limit > 0 ? ", %u files/sec" : " %u files/sec";
+            text_for_limit = text_for_limit + String::initWithFormat(format, files_limit);
+        }
+
+        // Skipped files count toward completion but not toward the copy rate.  Under a limit the copy
+        // cannot go faster than the limit, whatever it managed before.
+        const auto bytes_remaining = std::max(total_bytes - bytes_copied - bytes_skipped, 0.0);
+        const auto files_done = progress.files_copied + progress.files_skipped;
+        const auto total_files = m_model.total_files.load();
+        const auto remaining_time =
+            std::max(m_model.throttle.estimate_seconds(static_cast<size_type>(bytes_remaining),
+                                                       total_files > files_done ? total_files - files_done : 0,
+                                                       m_bytes_per_second),
+                     0.0);
         const auto remaining_milliseconds = std::chrono::milliseconds(static_cast<uint64_t>(remaining_time * 1000));
         const auto formatted_remaining_time = m_duration_formatter.string_from_duration(remaining_milliseconds);
-        const auto text_for_time_remaining = String::initWithFormat("remaining: %@", &formatted_remaining_time);
+        const auto text_for_time_remaining = String::initWithFormat(
+            scan_complete ? "remaining: %@" : "remaining: >%@", &formatted_remaining_time);
+
+        const auto show_skipped = m_model.sync || m_model.resume;
+        const auto formatted_bytes_skipped = format_total_bytes(bytes_skipped);
+        const auto text_for_skipped =
+            String::initWithFormat("skipped: %u files (%@)", progress.files_skipped, &formatted_bytes_skipped);
 
         const auto individual_file_progress_box =
-            hbox({gauge(m_percent_current_file_copied) | color(m_model.text_color)});
-        const auto overall_file_progress_box = hbox({gauge(m_percent_files_copied) | color(m_model.text_color)});
+            hbox({gauge(percent_current_file_copied) | color(m_model.text_color)});
+        const auto overall_file_progress_box = hbox({gauge(percent_files_copied) | color(m_model.text_color)});
         const auto statistics_box =
             hbox({filler(), separator(), text(duration_text.stlString()) | color(m_model.text_color), separator(),
                   text(text_for_file_progress.stlString()) | color(m_model.text_color), separator(),
                   text(text_for_copy_rate.stlString()) | color(m_model.text_color), separator(),
-                  text(text_for_time_remaining.stlString()) | color(m_model.text_color), separator(), filler()});
+                  text(text_for_time_remaining.stlString()) | color(m_model.text_color), separator(),
+                  show_skipped ? text(text_for_skipped.stlString()) | color(m_model.text_color) : filler(),
+                  show_skipped ? separator() : filler(),
+                  show_limit ? text(text_for_limit.stlString()) | color(m_model.text_color) : filler(),
+                  show_limit ? separator() : filler(), filler()});
+
+        // Per-phase latencies, shown on request.
+        Elements timings_lines{};
+        if (m_show_timings)
+        {
+            const auto report = m_model.timings.report();
+            std::string::size_type start{0};
+            for (auto end = report.find('\n'); end != std::string::npos; end = report.find('\n', start))
+            {
+                timings_lines.push_back(text(report.substr(start, end - start)) | color(m_model.text_color));
+                start = end + 1;
+            }
+        }
+        const auto timings_box = m_show_timings ? vbox({separator(), hbox({filler(), vbox(timings_lines), filler()})})
+                                                : filler();
+
+        Elements mismatch_lines{};
+        for (size_t i = 0; i < m_mismatches.size() && i < mismatches_shown; i++)
+        {
+            mismatch_lines.push_back(text(m_mismatches[i]) | size(WIDTH, LESS_THAN, 100) | color(Color::Red));
+        }
+        if (m_mismatches.size() > mismatches_shown)
+        {
+            const auto more =
+                String::initWithFormat("...and %u more, see the log", m_mismatches.size() - mismatches_shown);
+            mismatch_lines.push_back(text(more.stlString()) | color(Color::Red));
+        }
+        const auto mismatches_box = m_mismatches.empty() ? filler() : vbox({separator(), vbox(mismatch_lines)});
+
+        const auto progress_message =
+            m_model.verifying ? std::string{"Verifying copied files..."} : m_progress_message;
 
         return main_ui_element(
             {filler(),
              hbox(
                  {filler(),
                   vbox({filler(),
-                        hbox({text(m_progress_message) | size(WIDTH, EQUAL, 70) | color(m_model.text_color), filler()}),
+                        hbox({text(progress_message) | size(WIDTH, EQUAL, 70) | color(m_model.text_color), filler()}),
                         separator(), individual_file_progress_box, separator(), overall_file_progress_box, separator(),
-                        statistics_box, separator(),
+                        statistics_box, timings_box, mismatches_box, separator(),
                         hbox({filler(), m_buttons->Render(), filler()}) | color(m_model.text_color), filler()}) |
                       border | bgcolor(m_model.foreground_window_background_color) |
                       color(m_model.foreground_window_foreground_color),
@@ -107,255 +226,125 @@ namespace copy
     {
         if (! m_copy_thread_started)
         {
+            m_start_copy_time = SystemDate{};
+            m_rate_sample_time = std::chrono::steady_clock::now();
 
-            std::function<void()> copy_function{};
+            std::function<void()> copy_function = [this] {
+                CopyOperation operation{m_model};
 
-            LOG(LogPriority::Info, "source path %@ destination path %@", m_model.source_path, m_model.destination_path)
+                // These run on the copy workers for every chunk and file, so they only touch atomics.
+                operation.set_progress_callback([this](auto & job, auto size) {
+                    m_progress.add_bytes_copied(size);
 
-            if (m_file_manager.fileExistsAtPath(m_model.source_path))
-            {
-                if (m_file_manager.directoryExistsAtPath(m_model.destination_path))
-                {
-                    auto base_name = m_file_manager.baseNameOfItemAtPath(m_model.source_path);
-                    m_model.destination_path += FileManager::pathSeparator + base_name;
-                }
-
-                auto properties = m_file_manager.propertiesForItemAtPath(m_model.source_path);
-                m_progress_meter.set_total(m_model.total_bytes);
-                m_current_file_progress_meter.set_total(m_model.total_bytes);
-
-                copy_function = [this] {
-                    Sleep(std::chrono::milliseconds(500));
-                    m_start_copy_time = SystemDate{};
-
-                    auto notifier = ItemCopier::notifier_type{[this](auto & size) {
-                        m_progress_meter.increment_by(size);
-                        m_progress_meter.notify();
-                        m_model.bytes_remaining -= size;
-                        m_bytes_copied += static_cast<decltype(m_bytes_copied)>(size);
+                    // With several workers the per-file gauge follows the most recently started file.  The
+                    // ranges of a large file share its id, so their progress adds up here.
+                    if (job.id == m_current_file_id.load(std::memory_order_relaxed))
+                    {
+                        m_current_file_bytes.fetch_add(size, std::memory_order_relaxed);
+                    }
+                });
 
-                        m_current_file_progress_meter.increment_by(size);
-                        m_current_file_progress_meter.notify();
-                    }};
+                operation.set_file_started_callback([this](auto & job) {
+                    // A tiny file is done before the gauge or the message could show it.
+                    if (job.size <= CopyEngine::tiny_file_size)
+                    {
+                        return;
+                    }
+                    update_progress_message("Copying " + m_file_manager.baseNameOfItemAtPath(job.source_path));
 
-                    auto interrupter = [this]() -> bool {
-                        return m_interrupted;
-                    };
+                    m_current_file_id = 0;
+                    m_current_file_bytes = 0;
+                    m_current_file_size = job.allocated_size;
+                    m_current_file_id = job.id;
+                });
 
-                    auto base_file_name = m_file_manager.baseNameOfItemAtPath(m_model.source_path);
+                operation.set_file_skipped_callback([this](auto & job) {
+                    m_progress.add_file_skipped(job.allocated_size);
+                });
 
-                    update_progress_message("Copying " + base_file_name);
+                operation.set_file_finished_callback([this](auto &) {
+                    m_progress.add_file_copied();
+                });
 
-                    ItemCopier copier{m_model.source_path, m_model.destination_path};
-                    copier.set_notifier(notifier);
-                    copier.set_interrupter(interrupter);
-                    copier.copy();
+                operation.set_error_callback([this](auto & message) {
+                    update_progress_message(message);
+                });
 
-                    const auto permissions = m_file_manager.permissionsForItemAtPath(m_model.source_path);
-                    m_file_manager.setPermissionsForItemAtPath(m_model.destination_path, permissions);
+                operation.set_mismatch_callback([this](auto & message) {
+                    std::lock_guard<std::mutex> lock(m_progress_message_mutex);
+                    m_mismatches.push_back(message.stlStringInUTF8());
+                });
 
-                    update_progress_message("Finished Copying!");
-                    m_copy_thread_finished = true;
+                operation.set_interrupter([this]() -> bool {
+                    return m_interrupted;
+                });
 
-                    m_file_progress_notifier.notify(1);
-                    m_screen.PostEvent(Event::Custom);
-                };
-            }
-            else if (m_file_manager.directoryExistsAtPath(m_model.source_path))
-            {
-                if (m_file_manager.fileExistsAtPath(m_model.destination_path))
+                if (operation.copy())
                 {
-                    auto message = String::initWithFormat("cannot overwrite non-directory '%@' with directory '%@'",
-                                                          &m_model.destination_path, &m_model.source_path);
-                    update_progress_message(message);
-                    m_copy_thread_finished = true;
-                    return;
+                    update_progress_message(m_model.verify ? "Finished Copying! Verified." : "Finished Copying!");
                 }
-
-                m_progress_meter.set_total(m_model.total_bytes);
-                copy_function = [this] {
-                    m_start_copy_time = SystemDate{};
-                    bool encounteredError{false};
-
-                    auto notifier = ItemCopier::notifier_type{[this](auto & size) {
-                        m_progress_meter.increment_by(size);
-                        m_progress_meter.notify();
-                        m_model.bytes_remaining -= size;
-                        m_bytes_copied += static_cast<decltype(m_bytes_copied)>(size);
-
-                        m_current_file_progress_meter.increment_by(size);
-                        m_current_file_progress_meter.notify();
-                    }};
-
-                    auto interrupter = [this]() -> bool {
-                        return m_interrupted;
-                    };
-
-                    m_file_manager.walkItemsAtPath(
-                        true, m_model.source_path,
-                        [this, &notifier, &interrupter, &encounteredError](const String & path) -> bool {
-                            auto directory_path_part = m_file_manager.dirNameOfItemAtPath(path);
-                            auto base_file_name = m_file_manager.baseNameOfItemAtPath(path);
-
-                            String destination_path{};
-                            if (directory_path_part == m_model.source_path)
-                            {
-                                destination_path = m_model.destination_path;
-                            }
-                            else
-                            {
-                                auto sub_directory_part =
-                                    directory_path_part.substringFromIndex(m_model.source_path.length() + 1);
-                                destination_path =
-                                    m_model.destination_path + FileManager::pathSeparator + sub_directory_part;
-                            }
-
-                            String full_destination_path{destination_path + FileManager::pathSeparator +
-                                                         base_file_name};
-
-                            auto fix_problematic_path_component = [](const String & component) -> String {
-                                auto tmp_component = component.stringByReplacingOccurrencesOfStringWithString(":", "_");
-                                tmp_component =
-                                    tmp_component.stringByReplacingOccurrencesOfStringWithString("\"", "\\\\\"");
-                                tmp_component =
-                                    tmp_component.stringByReplacingOccurrencesOfStringWithString(" ", "\\ ");
-                                LOG(LogPriority::Info, tmp_component)
-                                if (tmp_component.last() == ' ')
-                                {
-                                    tmp_component = tmp_component.substringToIndex(tmp_component.length() - 1);
-                                }
-                                return tmp_component;
-                            };
-
-                            auto fix_problematic_file_paths =
-                                [fix_problematic_path_component](const String & path) -> String {
-                                auto path_components = path.substringsThatDoNotMatchString(FileManager::pathSeparator);
-                                String::string_array_type new_path_components{};
-                                for (auto & component : path_components)
-                                {
-                                    if (component.empty())
-                                    {
-                                        continue;
-                                    }
-                                    new_path_components.push_back(fix_problematic_path_component(component));
-                                }
-                                String new_path{FileManager::pathSeparator};
-                                for (String::string_array_type::size_type i = 0; i < new_path_components.size(); i++)
-                                {
-                                    new_path += new_path_components[i];
-                                    if (i < new_path_components.size() - 1)
-                                    {
-                                        new_path += FileManager::pathSeparator;
-                                    }
-                                }
-                                return new_path;
-                            };
-
-                            if (m_model.fix_problematic_file_paths)
-                            {
-                                destination_path = fix_problematic_file_paths(destination_path);
-                                full_destination_path = fix_problematic_file_paths(full_destination_path);
-                            }
-
-                            if (m_file_manager.directoryExistsAtPath(path))
-                            {
-                                if (! m_file_manager.directoryExistsAtPath(full_destination_path))
-                                {
-                                    try
-                                    {
-                                        m_file_manager.createDirectoriesAtPath(full_destination_path);
-                                    }
-                                    catch (std::exception & e)
-                                    {
-                                        encounteredError = true;
-                                        LOG(LogPriority::Critical,
-                                            "Error creating directory: " + full_destination_path + ": " + e.what())
-                                        update_progress_message("Error creating directory: " + full_destination_path +
-                                                                ": " + e.what());
-                                        return false;
-                                    }
-                                }
-                                return true;
-                            }
-
-                            if (! m_file_manager.directoryExistsAtPath(destination_path))
-                            {
-                                try
-                                {
-                                    m_file_manager.createDirectoriesAtPath(destination_path);
-                                }
-                                catch (std::exception & e)
-                                {
-                                    encounteredError = true;
-                                    LOG(LogPriority::Critical,
-                                        "Error creating directory: " + destination_path + ": " + e.what())
-                                    update_progress_message("Error creating directory: " + destination_path + ": " +
-                                                            e.what());
-                                    return false;
-                                }
-                            }
-
-                            update_progress_message("Copying " + base_file_name);
-
-                            auto path_properties = m_model.file_manager.propertiesForItemAtPath(path);
-
-                            m_current_file_progress_meter.set_total(path_properties.size);
-                            m_current_file_progress_meter.reset();
-
-                            try
-                            {
-                                auto copier = ItemCopier{path, full_destination_path};
-                                copier.set_notifier(notifier);
-                                copier.set_interrupter(interrupter);
-                                copier.copy();
-                            }
-                            catch (std::exception & e)
-                            {
-                                encounteredError = true;
-                                LOG(LogPriority::Critical,
-                                    "Error copying: " + path + " to " + full_destination_path + e.what())
-                                update_progress_message("Error copying " + path + " to " + full_destination_path +
-                                                        ": " + e.what());
-                                return false;
-                            }
-
-                            if (m_interrupted)
-                            {
-                                return false;
-                            }
-
-                            auto permissions = m_file_manager.permissionsForItemAtPath(path);
-                            m_file_manager.setPermissionsForItemAtPath(full_destination_path, permissions);
-
-                            m_file_progress_notifier.notify(1);
-                            m_screen.PostEvent(Event::Custom);
-                            return true;
-                        });
-
-                    if (! encounteredError)
+                else
+                {
+                    std::lock_guard<std::mutex> lock(m_progress_message_mutex);
+                    if (! m_mismatches.empty())
                     {
-                        update_progress_message("Finished Copying!");
+                        m_progress_message =
+                            String::initWithFormat("Verification found %u mismatches", m_mismatches.size())
+                                .stlStringInUTF8();
                     }
-                    m_copy_thread_finished = true;
-                };
-            }
-            else
-            {
-                LOG(LogPriority::Info, "Did not catch a valid case")
-            }
+                }
+                m_copy_thread_finished = true;
+                m_screen.PostEvent(Event::Custom);
+            };
 
             std::thread copy_function_thread{copy_function};
             copy_function_thread.detach();
             m_copy_thread_started = true;
 
-            std::thread timer_tickle_thread{[this] {
+            std::thread refresh_thread{[this] {
                 while (! m_copy_thread_finished)
                 {
-                    Sleep(std::chrono::seconds(1));
+                    Sleep(refresh_interval);
                     m_screen.PostEvent(Event::Custom);
                 }
             }};
-            timer_tickle_thread.detach();
+            refresh_thread.detach();
+        }
+    }
+
+    void CopyPanel::update_rate(double bytes_copied)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        const auto elapsed = std::chrono::duration<double>(now - m_rate_sample_time).count();
+        if (elapsed < rate_sample_seconds)
+        {
+            return;
+        }
+
+        const auto sample = (bytes_copied - m_rate_sample_bytes) / elapsed;
+        const auto weight = elapsed / (elapsed + rate_smoothing_seconds);
+        m_bytes_per_second = m_rate_sampled ? m_bytes_per_second + weight * (sample - m_bytes_per_second) : sample;
+        m_rate_sampled = true;
+        m_rate_sample_time = now;
+        m_rate_sample_bytes = bytes_copied;
+    }
+
+    void CopyPanel::change_limits(double factor)
+    {
+        // Without a limit, Slower starts from the rate the copy is making now.
+        auto & throttle = m_model.throttle;
+        const auto bytes_limit = throttle.bytes_per_second();
+        if (bytes_limit > 0 || factor < 1.0)
+        {
+            const auto base = bytes_limit > 0 ? static_cast<double>(bytes_limit) : m_bytes_per_second;
+            throttle.set_bytes_per_second(
+                std::max(static_cast<size_type>(base * factor), minimum_bytes_per_second));
+        }
+
+        if (const auto files_limit = throttle.files_per_second(); files_limit > 0)
+        {
+            throttle.set_files_per_second(std::max<size_type>(
+                static_cast<size_type>(static_cast<double>(files_limit) * factor), 1));
         }
     }
 
@@ -363,7 +352,6 @@ namespace copy
     {
         std::lock_guard<std::mutex> lock(m_progress_message_mutex);
         m_progress_message = message.stlStringInUTF8();
-        m_screen.PostEvent(Event::Custom);
     }
 
 } // namespace copy
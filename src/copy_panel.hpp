@@ -31,11 +31,16 @@
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/screen_interactive.hpp>
 #include <ftxui/dom/elements.hpp>
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <string>
+#include <vector>
 
 #include "TFFoundation.hpp"
 #include "data_model.hpp"
 #include "base_panel.hpp"
+#include "progress_counters.hpp"
 
 using namespace TF::Foundation;
 using namespace ftxui;
@@ -52,31 +57,43 @@ namespace copy
 
         void Refresh() override;
 
-    private:
         using size_type = uint64_t;
 
+    private:
         Component m_buttons{};
 
         FileManager m_file_manager{};
-        ProgressMeter<size_type> m_progress_meter{};
-        ProgressMeter<size_type> m_current_file_progress_meter{};
-        BasicProgressNotifier<size_type> m_file_progress_notifier{};
+        ProgressCounters m_progress;
         bool m_copy_thread_started{false};
-        bool m_copy_thread_finished{false};
-        bool m_interrupted{false};
+        std::atomic<bool> m_copy_thread_finished{false};
+        std::atomic<bool> m_interrupted{false};
+        bool m_show_timings{false};
+
+        // The file the per-file gauge follows.
+        std::atomic<size_type> m_current_file_id{0};
+        std::atomic<size_type> m_current_file_size{0};
+        std::atomic<size_type> m_current_file_bytes{0};
 
-        double m_bytes_copied{0.0};
+        // The copy rate, smoothed over the samples Render() takes.
         double m_bytes_per_second{1.0};
-        size_type m_current_files{0};
-        float m_percent_files_copied{0.0};
-        float m_percent_current_file_copied{0.0};
+        bool m_rate_sampled{false};
+        double m_rate_sample_bytes{0};
+        std::chrono::steady_clock::time_point m_rate_sample_time{};
+
         std::string m_progress_message{};
+        // Files the verify stage found different; guarded by the message mutex as well.
+        std::vector<std::string> m_mismatches{};
         std::mutex m_progress_message_mutex{};
 
         SystemDate m_start_copy_time{};
         DurationFormatter m_duration_formatter{"hh:mm:ss"};
 
         void update_progress_message(const String & message);
+
+        void update_rate(double bytes_copied);
+
+        // Scales the limits by @e factor from the Slower and Faster buttons.
+        void change_limits(double factor);
     };
 
 } // namespace copy
@@ -0,0 +1,206 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <fstream>
+#include <limits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#    include <linux/fiemap.h>
+#    include <linux/fs.h>
+#    include <sys/ioctl.h>
+#    include <sys/sysmacros.h>
+#endif
+#include "copy_scheduler.hpp"
+#include "file_descriptor.hpp"
+
+namespace copy
+{
+
+    CopyScheduler::CopyScheduler(Order order, std::string source_root) :
+        m_order{order}, m_source_root{std::move(source_root)}
+    {}
+
+    void CopyScheduler::add(const FileInventory::Entry & entry, std::string_view relative_path)
+    {
+        m_items.push_back(Item{entry, std::string{relative_path}, entry.inode});
+    }
+
+    auto CopyScheduler::take() -> const std::vector<Item> &
+    {
+        m_taken.clear();
+        std::swap(m_taken, m_items);
+
+        sort_by_key();
+        if (m_order == Order::Extent && ! m_extents_unsupported)
+        {
+            if (key_by_extent())
+            {
+                sort_by_key();
+            }
+            else
+            {
+                m_extents_unsupported = true;
+            }
+        }
+        return m_taken;
+    }
+
+    void CopyScheduler::sort_by_key()
+    {
+        // Stable, so files with equal keys keep their scan order.
+        std::stable_sort(m_taken.begin(), m_taken.end(), [](const Item & left, const Item & right) {
+            return left.key < right.key;
+        });
+    }
+
+    auto CopyScheduler::key_by_extent() -> bool
+    {
+#if defined(__linux__)
+        // One extent is all it takes to know where a file starts.
+        alignas(struct fiemap) std::array<char, sizeof(struct fiemap) + sizeof(struct fiemap_extent)> buffer{};
+        auto * request = reinterpret_cast<struct fiemap *>(buffer.data());
+
+        std::vector<uint64_t> keys(m_taken.size());
+        std::string path{};
+        for (size_t i = 0; i < m_taken.size(); i++)
+        {
+            path.assign(m_source_root).append(1, '/').append(m_taken[i].relative_path);
+            FileDescriptor file{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+            if (! file.is_valid())
+            {
+                // The copy reports the file; it goes last.
+                keys[i] = std::numeric_limits<uint64_t>::max();
+                continue;
+            }
+
+            buffer.fill(0);
+            request->fm_length = FIEMAP_MAX_OFFSET;
+            request->fm_extent_count = 1;
+            if (::ioctl(file.get(), FS_IOC_FIEMAP, request) != 0)
+            {
+                if (errno == EOPNOTSUPP || errno == ENOTTY || errno == ENOTSUP)
+                {
+                    return false;
+                }
+                keys[i] = std::numeric_limits<uint64_t>::max();
+                continue;
+            }
+
+            // Files without data, or with it inlined in the inode, cost no seek of their own.
+            const auto & extent = request->fm_extents[0];
+            keys[i] = request->fm_mapped_extents == 0 || (extent.fe_flags & FIEMAP_EXTENT_DATA_INLINE) != 0
+                          ? 0
+                          : extent.fe_physical;
+        }
+
+        for (size_t i = 0; i < m_taken.size(); i++)
+        {
+            m_taken[i].key = keys[i];
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    auto CopyScheduler::order_for(Order order, const std::string & path) -> Order
+    {
+        if (order != Order::Auto)
+        {
+            return order;
+        }
+        return is_rotational(path) ? Order::Extent : Order::Scan;
+    }
+
+    auto CopyScheduler::is_rotational(const std::string & path) -> bool
+    {
+#if defined(__linux__)
+        struct stat status
+        {};
+        if (::stat(path.c_str(), &status) != 0)
+        {
+            return false;
+        }
+
+        // A partition has no queue of its own; its disk is the directory above it.
+        const auto device =
+            "/sys/dev/block/" + std::to_string(major(status.st_dev)) + ":" + std::to_string(minor(status.st_dev));
+        for (const auto * queue : {"/queue/rotational", "/../queue/rotational"})
+        {
+            std::ifstream file{device + queue};
+            char flag{};
+            if (file >> flag)
+            {
+                return flag == '1';
+            }
+        }
+#else
+        (void)path;
+#endif
+        return false;
+    }
+
+    auto CopyScheduler::order_name(Order order) -> const char *
+    {
+        switch (order)
+        {
+            case Order::Scan:
+                return "scan";
+            case Order::Inode:
+                return "inode";
+            case Order::Extent:
+                return "extent";
+            case Order::Auto:
+                return "auto";
+        }
+        return "unknown";
+    }
+
+    auto CopyScheduler::order_named(const std::string & name, Order & order) -> bool
+    {
+        std::string lower{name};
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char character) {
+            return static_cast<char>(std::tolower(character));
+        });
+
+        for (auto candidate : {Order::Scan, Order::Inode, Order::Extent, Order::Auto})
+        {
+            if (lower == order_name(candidate))
+            {
+                order = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // namespace copy
@@ -0,0 +1,142 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef COPY_SCHEDULER_HPP
+#define COPY_SCHEDULER_HPP
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "file_inventory.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that reorders files before they are copied so a spinning disk reads them with
+     * fewer seeks.
+     *
+     * The copy hands files over in scan order and takes them back in windows.  Inode order follows
+     * the inode numbers the scan already has.  On most file systems they track where the inodes
+     * sit, and loosely where the data was allocated.  Extent order asks FIEMAP for the physical
+     * offset of each file's first extent and reads the files in disk order.  The lookups go in
+     * inode order, since each one reads an inode.  A file system without FIEMAP falls back to
+     * inode order.
+     *
+     * A window is handed back when it is full, when the scan ends, or, while a streaming copy
+     * catches up with the scan, as soon as the next entry is not scanned yet.  A streaming copy
+     * therefore never waits for the scan with files in hand; its windows are only as large as the
+     * scan is ahead.
+     */
+    class CopyScheduler
+    {
+    public:
+        using size_type = uint64_t;
+
+        enum class Order
+        {
+            Scan,
+            Inode,
+            Extent,
+            Auto
+        };
+
+        struct Item
+        {
+            FileInventory::Entry entry{};
+            std::string relative_path{};
+            uint64_t key{0};
+        };
+
+        // Enough for the order to matter, bounded so a huge tree does not have to fit in memory twice.
+        static constexpr size_type window_size{256 * 1024};
+
+        /**
+         * @param order the order; Auto must be resolved with order_for() first.
+         * @param source_root the directory the relative paths start from, for FIEMAP.
+         */
+        CopyScheduler(Order order, std::string source_root);
+
+        [[nodiscard]] auto order() const -> Order
+        {
+            return m_order;
+        }
+
+        void add(const FileInventory::Entry & entry, std::string_view relative_path);
+
+        [[nodiscard]] auto is_full() const -> bool
+        {
+            return m_items.size() >= window_size;
+        }
+
+        [[nodiscard]] auto empty() const -> bool
+        {
+            return m_items.empty();
+        }
+
+        /**
+         * @return the files added since the last call, sorted.  They stay valid until the next add().
+         */
+        auto take() -> const std::vector<Item> &;
+
+        /**
+         * @return @e order, with Auto resolved: Extent if @e path is on a rotational device,
+         * otherwise Scan.
+         */
+        [[nodiscard]] static auto order_for(Order order, const std::string & path) -> Order;
+
+        /**
+         * @return true if the block device under @e path reports itself rotational in sysfs.
+         */
+        [[nodiscard]] static auto is_rotational(const std::string & path) -> bool;
+
+        [[nodiscard]] static auto order_name(Order order) -> const char *;
+
+        /**
+         * @brief method to look up an order by name (scan, inode, extent or auto), ignoring case.
+         * @return false if @e name is not an order; @e order is then unchanged.
+         */
+        static auto order_named(const std::string & name, Order & order) -> bool;
+
+    private:
+        Order m_order{Order::Scan};
+        std::string m_source_root{};
+        std::vector<Item> m_items{};
+        std::vector<Item> m_taken{};
+        bool m_extents_unsupported{false};
+
+        /**
+         * @return false if the file system cannot report extents; the keys are then inode numbers.
+         */
+        auto key_by_extent() -> bool;
+
+        void sort_by_key();
+    };
+
+} // namespace copy
+
+#endif // COPY_SCHEDULER_HPP
@@ -28,9 +28,22 @@
 #ifndef DATA_MODEL_HPP
 #define DATA_MODEL_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <thread>
+#include <unistd.h>
 #include <ftxui/component/component_options.hpp>
 #include "TFFoundation.hpp"
+#include "buffer_pool.hpp"
+#include "content_hash.hpp"
+#include "copy_scheduler.hpp"
+#include "duplicate_finder.hpp"
+#include "file_copier.hpp"
+#include "file_inventory.hpp"
+#include "phase_timings.hpp"
+#include "throttle.hpp"
 
 using namespace TF::Foundation;
 using namespace ftxui;
@@ -63,11 +76,73 @@ namespace copy
 
         bool fix_problematic_file_paths{false};
 
-        size_type total_files{0};
-        size_type total_bytes{0};
-        size_type bytes_remaining{0};
+        size_type copy_jobs{std::max<size_type>(std::thread::hardware_concurrency(), 1)};
+
+        // When set, copying starts right away and the scan keeps refining the totals below.
+        bool stream_copy{false};
+
+        bool use_io_uring{false};
+
+        // Skip files whose destination already matches; by size and time, or by content.
+        bool sync{false};
+        bool sync_by_content{false};
+
+        // Skip files that the journal of an interrupted copy recorded as finished.
+        bool resume{false};
+
+        // Keep times, owners, extended attributes and ACLs, and copy symbolic links as links.  Implies
+        // hard_links.
+        bool preserve{false};
+
+        // Recreate hard links as links instead of copying every name of a file.
+        bool hard_links{false};
+
+        // Link or clone files whose contents match a file copied earlier.
+        DuplicateFinder::Mode dedup{DuplicateFinder::Mode::Off};
+
+        // Hash the data while copying, then read the destination back and compare.
+        bool verify{false};
+        ContentHasher::Algorithm verify_algorithm{ContentHasher::Algorithm::XXH3};
+
+        // Run without the UI and write JSON progress lines to a descriptor instead.
+        bool headless{false};
+        std::chrono::milliseconds progress_interval{1000};
+        int progress_descriptor{STDOUT_FILENO};
+
+        // The read/write buffer size; zero tunes it from the file systems and the measured throughput.
+        size_type buffer_size{0};
+
+        // How much of the copied data may stay in the page cache; see FileCopier::CacheMode.
+        FileCopier::CacheMode cache_mode{FileCopier::CacheMode::Normal};
+
+        // The order files are copied in; Auto sorts them by disk position when the source is on a
+        // rotational device.
+        CopyScheduler::Order copy_order{CopyScheduler::Order::Auto};
+
+        // How many queued files to read ahead of the workers; zero turns read ahead off.
+        size_type prefetch_files{16};
+
+        // Files this large are split into ranges that several workers copy at once.
+        size_type large_file_threshold{256 * 1024 * 1024};
+
+        std::atomic<size_type> total_files{0};
+        std::atomic<size_type> total_bytes{0};
+        std::atomic<bool> scan_complete{false};
+        // Set when the scan could not read part of the source, which the copy then reports.
+        std::atomic<bool> scan_failed{false};
+        std::atomic<bool> verifying{false};
 
         FileManager file_manager{};
+        FileInventory inventory{};
+
+        // Per-phase latency histograms for the scan and the copy.
+        PhaseTimings timings{};
+
+        // I/O buffers shared by every copy, and their tuned size.
+        BufferPool buffer_pool{};
+
+        // Bytes and files per second the copy may use; the copy panel changes them while it runs.
+        Throttle throttle{};
 
         String source_path{};
         String destination_path{};
@@ -0,0 +1,124 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "directory_cache.hpp"
+
+namespace copy
+{
+
+    auto DirectoryCache::ensure(std::string_view path) -> int
+    {
+        while (path.size() > 1 && path.back() == '/')
+        {
+            path.remove_suffix(1);
+        }
+
+        if (path.empty() || path == "/" || m_known.find(path) != m_known.end())
+        {
+            return 0;
+        }
+
+        // A relative path without a slash lives in the working directory.
+        const auto separator = path.rfind('/');
+        auto descriptor = AT_FDCWD;
+        auto name = path;
+        if (separator != std::string_view::npos)
+        {
+            const auto parent = separator == 0 ? path.substr(0, 1) : path.substr(0, separator);
+            if (const auto error = ensure(parent); error != 0)
+            {
+                return error;
+            }
+            descriptor = parent_descriptor(std::string{parent});
+            if (descriptor < 0)
+            {
+                return errno;
+            }
+            name = path.substr(separator + 1);
+        }
+
+        const std::string name_string{name};
+        if (::mkdirat(descriptor, name_string.c_str(), 0777) != 0)
+        {
+            if (errno != EEXIST)
+            {
+                return errno;
+            }
+            struct stat status
+            {};
+            if (::fstatat(descriptor, name_string.c_str(), &status, 0) != 0)
+            {
+                return errno;
+            }
+            if (! S_ISDIR(status.st_mode))
+            {
+                return ENOTDIR;
+            }
+        }
+
+        m_known.emplace(path);
+        return 0;
+    }
+
+    void DirectoryCache::clear()
+    {
+        m_known.clear();
+        m_parents.clear();
+        m_parent_order.clear();
+    }
+
+    auto DirectoryCache::parent_descriptor(const std::string & path) -> int
+    {
+        if (auto parent = m_parents.find(path); parent != m_parents.end())
+        {
+            return parent->second.get();
+        }
+
+#if defined(O_PATH)
+        constexpr auto flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+#else
+        constexpr auto flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+#endif
+        FileDescriptor descriptor{::open(path.c_str(), flags)};
+        if (! descriptor.is_valid())
+        {
+            return -1;
+        }
+
+        if (m_parent_order.size() >= open_parent_limit)
+        {
+            m_parents.erase(m_parent_order.front());
+            m_parent_order.pop_front();
+        }
+        m_parent_order.push_back(path);
+        return m_parents.emplace(path, std::move(descriptor)).first->second.get();
+    }
+
+} // namespace copy
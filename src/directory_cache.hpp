@@ -0,0 +1,91 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef DIRECTORY_CACHE_HPP
+#define DIRECTORY_CACHE_HPP
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include "file_descriptor.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that makes sure destination directories exist, checking or creating each one
+     * once per run.
+     *
+     * Directories the cache has seen are kept in a hash set, so the thousands of files that share a
+     * parent cost a lookup instead of a stat(2).  A missing directory is created with mkdirat(2)
+     * relative to a descriptor for its parent, so the kernel does not walk the whole path again.
+     * Only a few parent descriptors stay open; the oldest is closed when another is needed.  Not
+     * thread safe.
+     */
+    class DirectoryCache
+    {
+    public:
+        // Children come right after their parent in scan order, so a short list of parents is enough.
+        static constexpr size_t open_parent_limit{64};
+
+        /**
+         * @brief method to create the directory at @e path, and any missing parents, unless the
+         * cache already knows it exists.  An existing link to a directory counts as a directory.
+         * @return zero, or the errno of the failure.
+         */
+        auto ensure(std::string_view path) -> int;
+
+        void clear();
+
+    private:
+        // Lets the set be searched with a string_view, without building a string for every file.
+        struct PathHash
+        {
+            using is_transparent = void;
+
+            auto operator()(std::string_view path) const -> size_t
+            {
+                return std::hash<std::string_view>{}(path);
+            }
+        };
+
+        std::unordered_set<std::string, PathHash, std::equal_to<>> m_known{};
+        std::unordered_map<std::string, FileDescriptor> m_parents{};
+        std::deque<std::string> m_parent_order{};
+
+        /**
+         * @return a descriptor for the known directory @e path, or -1 if it cannot be opened.
+         */
+        auto parent_descriptor(const std::string & path) -> int;
+    };
+
+} // namespace copy
+
+#endif // DIRECTORY_CACHE_HPP
@@ -0,0 +1,286 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include "duplicate_finder.hpp"
+#include "file_descriptor.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        constexpr size_t hash_buffer_size{1024 * 1024};
+    } // namespace
+
+    DuplicateFinder::DuplicateFinder(ContentHasher::Algorithm algorithm, size_type workers) :
+        m_algorithm{algorithm}, m_worker_count{workers > 0 ? workers : 1}
+    {}
+
+    auto DuplicateFinder::find(FileInventory & inventory, const std::string & source_root) -> result_type
+    {
+        std::vector<Candidate> candidates{};
+        std::unordered_set<Identity, Identity::Hash> identities{};
+        std::unordered_map<size_type, size_type> files_of_size{};
+
+        FileInventory::Entry entry{};
+        std::string relative_path{};
+        for (FileInventory::index_type index = 0; inventory.wait_for_entry(index, entry, relative_path); index++)
+        {
+            if (entry.type != FileInventory::EntryType::File || entry.size < smallest_candidate ||
+                ! identities.insert(FileInventory::identity_of(entry)).second)
+            {
+                continue;
+            }
+            candidates.push_back(
+                Candidate{FileInventory::identity_of(entry), entry.size, source_root + "/" + relative_path});
+            files_of_size[entry.size]++;
+        }
+
+        // A file with a size of its own cannot match anything, and needs no reading.
+        std::erase_if(candidates, [&files_of_size](const Candidate & candidate) {
+            return files_of_size[candidate.size] < 2;
+        });
+
+        run_in_parallel(candidates.size(), [this, &candidates] {
+            return [this, &candidates, hasher = ContentHasher{m_algorithm},
+                    buffer = std::vector<char>(hash_buffer_size)](size_t index) mutable {
+                candidates[index].hashed = hash(candidates[index], hasher, buffer);
+            };
+        });
+
+        if (interrupted())
+        {
+            return {};
+        }
+
+        // The candidates are still in inventory order, so the first file of a group is the first
+        // one the copy reaches.
+        using group_key = std::pair<size_type, decltype(ContentHasher::Digest::bytes)>;
+        std::map<group_key, size_t> first_of_group{};
+        std::vector<std::pair<size_t, size_t>> members{};
+        for (size_t index = 0; index < candidates.size(); index++)
+        {
+            if (! candidates[index].hashed)
+            {
+                continue;
+            }
+            const auto first =
+                first_of_group.emplace(group_key{candidates[index].size, candidates[index].digest.bytes}, index)
+                    .first->second;
+            if (first != index)
+            {
+                members.emplace_back(index, first);
+            }
+        }
+
+        // Equal digests only say the contents are probably the same; the bytes decide.
+        std::vector<char> same(members.size(), 0);
+        run_in_parallel(members.size(), [this, &candidates, &members, &same] {
+            return [this, &candidates, &members, &same, first_buffer = std::vector<char>(hash_buffer_size),
+                    second_buffer = std::vector<char>(hash_buffer_size)](size_t index) mutable {
+                const auto & [member, first] = members[index];
+                same[index] = same_contents(candidates[first], candidates[member], first_buffer, second_buffer);
+            };
+        });
+
+        if (interrupted())
+        {
+            return {};
+        }
+
+        result_type result{};
+        for (size_t index = 0; index < members.size(); index++)
+        {
+            if (same[index])
+            {
+                const auto & first = candidates[members[index].second].identity;
+                result.emplace(candidates[members[index].first].identity, first);
+                result.emplace(first, first);
+            }
+        }
+        return result;
+    }
+
+    template <typename WorkFactory>
+    void DuplicateFinder::run_in_parallel(size_t count, WorkFactory make_work) const
+    {
+        std::atomic<size_t> next{0};
+        auto worker = [this, count, &make_work, &next] {
+            auto work = make_work();
+            for (auto index = next++; index < count && ! interrupted(); index = next++)
+            {
+                work(index);
+            }
+        };
+
+        const auto thread_count = std::min<size_type>(m_worker_count, count);
+        std::vector<std::thread> threads{};
+        for (size_type i = 1; i < thread_count; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    auto DuplicateFinder::hash(Candidate & candidate, ContentHasher & hasher, std::vector<char> & buffer) const
+        -> bool
+    {
+        FileDescriptor file{::open(candidate.path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (! file.is_valid())
+        {
+            return false;
+        }
+#if defined(__linux__)
+        ::posix_fadvise(file.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        hasher.reset();
+        size_type offset{0};
+        while (! interrupted())
+        {
+            const auto bytes_read = ::pread(file.get(), buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+            hasher.update(buffer.data(), static_cast<size_t>(bytes_read));
+            offset += static_cast<size_type>(bytes_read);
+        }
+
+        // A file that changed since the scan is copied on its own.
+        if (offset != candidate.size)
+        {
+            return false;
+        }
+        candidate.digest = hasher.digest();
+        return true;
+    }
+
+    auto DuplicateFinder::same_contents(const Candidate & first, const Candidate & second,
+                                        std::vector<char> & first_buffer, std::vector<char> & second_buffer) const
+        -> bool
+    {
+        FileDescriptor first_file{::open(first.path.c_str(), O_RDONLY | O_CLOEXEC)};
+        FileDescriptor second_file{::open(second.path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (! first_file.is_valid() || ! second_file.is_valid())
+        {
+            return false;
+        }
+
+        auto read_full = [](int descriptor, std::vector<char> & buffer, size_type offset, size_t length) -> bool {
+            size_t done{0};
+            while (done < length)
+            {
+                const auto bytes_read =
+                    ::pread(descriptor, buffer.data() + done, length - done, static_cast<off_t>(offset + done));
+                if (bytes_read < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (bytes_read <= 0)
+                {
+                    return false;
+                }
+                done += static_cast<size_t>(bytes_read);
+            }
+            return true;
+        };
+
+        for (size_type offset = 0; offset < first.size && ! interrupted();)
+        {
+            const auto length = static_cast<size_t>(std::min<size_type>(first_buffer.size(), first.size - offset));
+            if (! read_full(first_file.get(), first_buffer, offset, length) ||
+                ! read_full(second_file.get(), second_buffer, offset, length) ||
+                std::memcmp(first_buffer.data(), second_buffer.data(), length) != 0)
+            {
+                return false;
+            }
+            offset += length;
+        }
+
+        // Either file may have grown since it was hashed.
+        char extra{};
+        return ! interrupted() && ::pread(first_file.get(), &extra, 1, static_cast<off_t>(first.size)) == 0 &&
+               ::pread(second_file.get(), &extra, 1, static_cast<off_t>(second.size)) == 0;
+    }
+
+    auto DuplicateFinder::mode_name(Mode mode) -> const char *
+    {
+        switch (mode)
+        {
+            case Mode::Off:
+                return "off";
+            case Mode::Link:
+                return "link";
+            case Mode::Reflink:
+                return "reflink";
+        }
+        return "unknown";
+    }
+
+    auto DuplicateFinder::mode_named(const std::string & name, Mode & mode) -> bool
+    {
+        std::string lower{name};
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char character) {
+            return static_cast<char>(std::tolower(character));
+        });
+
+        for (auto candidate : {Mode::Off, Mode::Link, Mode::Reflink})
+        {
+            if (lower == mode_name(candidate))
+            {
+                mode = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+} // namespace copy
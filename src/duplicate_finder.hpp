@@ -0,0 +1,135 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef DUPLICATE_FINDER_HPP
+#define DUPLICATE_FINDER_HPP
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "content_hash.hpp"
+#include "file_inventory.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that finds the files in a scanned tree whose contents match another file's, for
+     * --dedup.
+     *
+     * Only files that share their size with another file can match, so only those are read.  They
+     * are hashed whole on a pool of worker threads, and files with the same size and digest form a
+     * group.  The names of a hard linked file count as one file.  The digest only proposes a match:
+     * every file is compared byte for byte with the first file of its group before it joins, so a
+     * collision, accidental or crafted, never links files with different contents.  A file that
+     * fails the comparison is copied on its own.
+     */
+    class DuplicateFinder
+    {
+    public:
+        using size_type = uint64_t;
+        using Identity = FileInventory::Identity;
+        using result_type = std::unordered_map<Identity, Identity, Identity::Hash>;
+        using interrupter_type = std::function<bool()>;
+
+        enum class Mode
+        {
+            Off,
+            Link,
+            Reflink
+        };
+
+        // Linking files smaller than a block saves next to nothing.
+        static constexpr size_type smallest_candidate{4096};
+
+        DuplicateFinder(ContentHasher::Algorithm algorithm, size_type workers);
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to find the matching files in @e inventory.  Waits for the scan to finish.
+         * @param source_root the directory the paths in the inventory are relative to.
+         * @return for every file that matches another, the identity of the first file of its group
+         * in inventory order.  The first file maps to itself.  Empty if interrupted.
+         */
+        auto find(FileInventory & inventory, const std::string & source_root) -> result_type;
+
+        [[nodiscard]] static auto mode_name(Mode mode) -> const char *;
+
+        /**
+         * @brief method to look up a mode by name (off, link or reflink), ignoring case.
+         * @return false if @e name is not a mode; @e mode is then unchanged.
+         */
+        static auto mode_named(const std::string & name, Mode & mode) -> bool;
+
+    private:
+        struct Candidate
+        {
+            Identity identity{};
+            size_type size{0};
+            std::string path{};
+            ContentHasher::Digest digest{};
+            bool hashed{false};
+        };
+
+        ContentHasher::Algorithm m_algorithm{ContentHasher::Algorithm::XXH3};
+        size_type m_worker_count{1};
+        interrupter_type m_interrupter{};
+
+        /**
+         * @brief method to hash the whole of @e candidate into its digest.
+         * @return false if the file could not be read or no longer has the size the scan saw.
+         */
+        auto hash(Candidate & candidate, ContentHasher & hasher, std::vector<char> & buffer) const -> bool;
+
+        /**
+         * @return true if the files of @e first and @e second still have the scanned size and the
+         * same bytes.
+         */
+        auto same_contents(const Candidate & first, const Candidate & second, std::vector<char> & first_buffer,
+                           std::vector<char> & second_buffer) const -> bool;
+
+        /**
+         * @brief method to call work(index) for every index below @e count on the worker threads.
+         * @e make_work runs once per thread and returns that thread's work, so it can own buffers.
+         */
+        template <typename WorkFactory>
+        void run_in_parallel(size_t count, WorkFactory make_work) const;
+
+        [[nodiscard]] auto interrupted() const -> bool
+        {
+            return m_interrupter && m_interrupter();
+        }
+    };
+
+} // namespace copy
+
+#endif // DUPLICATE_FINDER_HPP
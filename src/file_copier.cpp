@@ -0,0 +1,843 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#    include <linux/fs.h>
+#    include <sys/ioctl.h>
+#    include <sys/sendfile.h>
+#endif
+#include "file_copier.hpp"
+#include "file_descriptor.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        [[noreturn]] void throw_errno(const std::string & what)
+        {
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+
+#if defined(__linux__)
+        // Large enough to keep the kernel busy, small enough for the progress gauges to move.
+        constexpr size_t kernel_chunk_size{8 * 1024 * 1024};
+
+        // Errors that mean "this data path does not work for this pair of files", as opposed to a
+        // real I/O failure.
+        auto is_unsupported_error(int error) -> bool
+        {
+            return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP ||
+                   error == ENOTSUP || error == EBADF || error == ETXTBSY || error == EPERM;
+        }
+
+        constexpr auto to_end_of_file = std::numeric_limits<FileCopier::size_type>::max();
+
+        // Holes are fed to the hasher from here, and written from here where they cannot be punched.
+        constexpr size_t zero_buffer_size{64 * 1024};
+        const std::vector<char> zero_buffer(zero_buffer_size);
+
+        // st_blocks counts 512 byte units whatever the file system's block size.
+        auto is_sparse(const struct stat & status) -> bool
+        {
+            return static_cast<FileCopier::size_type>(status.st_blocks) * 512 <
+                   static_cast<FileCopier::size_type>(status.st_size);
+        }
+
+        // O_DIRECT wants the offset, the length and the buffer aligned to the logical block size of
+        // the device.  A page covers every device in practice.
+        constexpr FileCopier::size_type direct_alignment{BufferPool::page_size};
+
+        auto round_up_to_direct(FileCopier::size_type value) -> FileCopier::size_type
+        {
+            return (value + direct_alignment - 1) / direct_alignment * direct_alignment;
+        }
+
+        auto has_direct(int descriptor) -> bool
+        {
+            const auto flags = ::fcntl(descriptor, F_GETFL);
+            return flags >= 0 && (flags & O_DIRECT) != 0;
+        }
+
+        auto set_direct(int descriptor, bool direct) -> bool
+        {
+            const auto flags = ::fcntl(descriptor, F_GETFL);
+            if (flags < 0)
+            {
+                return false;
+            }
+            const auto wanted = direct ? flags | O_DIRECT : flags & ~O_DIRECT;
+            return wanted == flags || ::fcntl(descriptor, F_SETFL, wanted) == 0;
+        }
+
+        // The flag belongs to the open file, so the ranges of a large file share it.  Every range
+        // turns it on as it starts, and a range that hits an unaligned offset turns it off again.
+        auto start_direct(int source, int destination) -> bool
+        {
+            if (set_direct(source, true) && set_direct(destination, true))
+            {
+                return true;
+            }
+            set_direct(source, false);
+            set_direct(destination, false);
+            return false;
+        }
+
+        // Returns false if neither descriptor had O_DIRECT, so an EINVAL had some other cause.
+        auto stop_direct(int source, int destination) -> bool
+        {
+            const auto had_direct = has_direct(source) || has_direct(destination);
+            set_direct(source, false);
+            set_direct(destination, false);
+            return had_direct;
+        }
+
+        // Writeback starts once this much has been written, and the window before it is dropped.
+        constexpr FileCopier::size_type drop_behind_window{8 * 1024 * 1024};
+
+        /**
+         * Keeps a copy from filling the page cache.  The writeback of each window starts as soon as
+         * it is written.  Once the next window is written, the copy waits for the first one and
+         * drops it from the cache on both sides, so about two windows stay cached.
+         */
+        class CacheDropper
+        {
+        public:
+            using size_type = FileCopier::size_type;
+
+            CacheDropper(int source, int destination, bool enabled) :
+                m_source{source}, m_destination{destination}, m_enabled{enabled}
+            {}
+
+            CacheDropper(const CacheDropper &) = delete;
+            auto operator=(const CacheDropper &) -> CacheDropper & = delete;
+
+            ~CacheDropper()
+            {
+                if (m_enabled)
+                {
+                    start_writeback();
+                    drop(m_previous_start, m_previous_end);
+                }
+            }
+
+            void written(size_type offset, size_type length)
+            {
+                if (! m_enabled || length == 0)
+                {
+                    return;
+                }
+                if (offset != m_end)
+                {
+                    // A hole, or the next extent; the window starts over.
+                    start_writeback();
+                    m_start = offset;
+                }
+                m_end = offset + length;
+                if (m_end - m_start >= drop_behind_window)
+                {
+                    start_writeback();
+                }
+            }
+
+        private:
+            int m_source{-1};
+            int m_destination{-1};
+            bool m_enabled{false};
+            size_type m_start{0};
+            size_type m_end{0};
+            size_type m_previous_start{0};
+            size_type m_previous_end{0};
+
+            void start_writeback()
+            {
+                if (m_end <= m_start)
+                {
+                    return;
+                }
+                ::sync_file_range(m_destination, static_cast<off_t>(m_start), static_cast<off_t>(m_end - m_start),
+                                  SYNC_FILE_RANGE_WRITE);
+                drop(m_previous_start, m_previous_end);
+                m_previous_start = m_start;
+                m_previous_end = m_end;
+                m_start = m_end;
+            }
+
+            // Dirty pages cannot be dropped, so wait for their writeback first.  Failures are only lost
+            // advice; write errors still surface when the file is closed.
+            void drop(size_type start, size_type end) const
+            {
+                if (end <= start)
+                {
+                    return;
+                }
+                const auto offset = static_cast<off_t>(start);
+                const auto length = static_cast<off_t>(end - start);
+                ::sync_file_range(m_destination, offset, length,
+                                  SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                ::posix_fadvise(m_destination, offset, length, POSIX_FADV_DONTNEED);
+                ::posix_fadvise(m_source, offset, length, POSIX_FADV_DONTNEED);
+            }
+        };
+#else
+        constexpr FileCopier::size_type direct_alignment{1};
+
+        auto round_up_to_direct(FileCopier::size_type value) -> FileCopier::size_type
+        {
+            return value;
+        }
+
+        auto start_direct(int, int) -> bool
+        {
+            return false;
+        }
+
+        auto stop_direct(int, int) -> bool
+        {
+            return false;
+        }
+
+        class CacheDropper
+        {
+        public:
+            CacheDropper(int, int, bool) {}
+
+            void written(FileCopier::size_type, FileCopier::size_type) {}
+        };
+#endif
+    } // namespace
+
+    FileCopier::FileCopier(const String & source, const String & destination) :
+        m_source_path{source}, m_destination_path{destination}
+    {}
+
+    void FileCopier::copy()
+    {
+#if defined(__linux__)
+        const auto source_path = m_source_path.stlStringInUTF8();
+        const auto destination_path = m_destination_path.stlStringInUTF8();
+
+        PhaseTimings::Timer open_timer{m_timings, PhaseTimings::Phase::Open};
+        FileDescriptor source{::open(source_path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (source.get() < 0)
+        {
+            throw_errno("unable to open " + source_path);
+        }
+        open_timer.stop();
+
+        struct stat source_stat
+        {};
+        PhaseTimings::Timer stat_timer{m_timings, PhaseTimings::Phase::Stat};
+        if (::fstat(source.get(), &source_stat) != 0)
+        {
+            throw_errno("unable to stat " + source_path);
+        }
+        stat_timer.stop();
+
+        PhaseTimings::Timer destination_open_timer{m_timings, PhaseTimings::Phase::Open};
+        FileDescriptor destination{::open(destination_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                          source_stat.st_mode & 07777)};
+        if (destination.get() < 0)
+        {
+            throw_errno("unable to open " + destination_path);
+        }
+        destination_open_timer.stop();
+
+        const auto size = static_cast<size_type>(source_stat.st_size);
+        size_type offset{0};
+
+        PhaseTimings::Timer transfer_timer{m_timings, PhaseTimings::Phase::Transfer};
+
+        if (size == 0)
+        {
+            // Empty, or a pseudo file that reports no size; only a plain read finds out which.
+            read_write(source.get(), destination.get(), offset, to_end_of_file);
+            m_method = Method::ReadWrite;
+        }
+        else if (! m_hasher && try_reflink(source.get(), destination.get(), size))
+        {
+            m_method = Method::Reflink;
+        }
+        else if (is_sparse(source_stat) && copy_extents(source.get(), destination.get(), offset, size, false))
+        {
+            // The destination was truncated, so the holes are already there; a trailing hole only needs
+            // the size set.
+            if (::ftruncate(destination.get(), static_cast<off_t>(size)) != 0)
+            {
+                throw_errno("unable to size " + destination_path);
+            }
+            m_method = Method::Sparse;
+        }
+        else if (needs_userspace())
+        {
+            read_write(source.get(), destination.get(), offset, to_end_of_file);
+            m_method = Method::ReadWrite;
+        }
+        else if (try_copy_file_range(source.get(), destination.get(), offset, to_end_of_file))
+        {
+            m_method = Method::CopyFileRange;
+        }
+        else if (try_sendfile(source.get(), destination.get(), offset))
+        {
+            m_method = Method::SendFile;
+        }
+        else
+        {
+            read_write(source.get(), destination.get(), offset, to_end_of_file);
+            m_method = Method::ReadWrite;
+        }
+
+        transfer_timer.stop();
+
+        if (m_metadata)
+        {
+            PhaseTimings::Timer metadata_timer{m_timings, PhaseTimings::Phase::Chmod};
+            m_metadata->apply(source.get(), destination.get(), source_stat, destination_path);
+        }
+
+        // Network file systems report deferred write errors on close.
+        PhaseTimings::Timer close_timer{m_timings, PhaseTimings::Phase::Close};
+        source.close();
+        if (destination.close() != 0 && errno != EINTR)
+        {
+            throw_errno("unable to close " + destination_path);
+        }
+        close_timer.stop();
+#else
+        if (m_hasher)
+        {
+            throw std::system_error(ENOTSUP, std::generic_category(), "hashing during a copy needs Linux");
+        }
+
+        ItemCopier copier{m_source_path, m_destination_path};
+        copier.set_notifier(m_notifier);
+        copier.set_interrupter(m_interrupter);
+        copier.copy();
+        m_method = Method::ItemCopier;
+
+        struct stat source_stat
+        {};
+        if (m_metadata && ::stat(m_source_path.stlStringInUTF8().c_str(), &source_stat) == 0)
+        {
+            PhaseTimings::Timer metadata_timer{m_timings, PhaseTimings::Phase::Chmod};
+            m_metadata->apply(m_source_path.stlStringInUTF8(), m_destination_path.stlStringInUTF8(), source_stat);
+        }
+#endif
+
+        LOG(LogPriority::Debug, "Copied " + m_source_path + " to " + m_destination_path + " using " +
+                                    String{method_name(m_method)})
+    }
+
+    void FileCopier::copy_small(size_type size, uint32_t mode)
+    {
+        const auto source_path = m_source_path.stlStringInUTF8();
+        const auto destination_path = m_destination_path.stlStringInUTF8();
+
+        PhaseTimings::Timer open_timer{m_timings, PhaseTimings::Phase::Open};
+        FileDescriptor source{::open(source_path.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (! source.is_valid())
+        {
+            throw_errno("unable to open " + source_path);
+        }
+        const auto flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        FileDescriptor destination{::open(destination_path.c_str(), flags, static_cast<mode_t>(mode & 07777))};
+        if (! destination.is_valid())
+        {
+            throw_errno("unable to open " + destination_path);
+        }
+        open_timer.stop();
+
+        PhaseTimings::Timer transfer_timer{m_timings, PhaseTimings::Phase::Transfer};
+        std::array<char, small_file_size> buffer;
+        size_type copied{0};
+        while (! interrupted())
+        {
+            const auto bytes_read = ::read(source.get(), buffer.data(), buffer.size());
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw_errno("unable to read " + source_path);
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+
+            const auto count = static_cast<size_t>(bytes_read);
+            for (size_t done = 0; done < count;)
+            {
+                const auto written = ::write(destination.get(), buffer.data() + done, count - done);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    throw_errno("unable to write " + destination_path);
+                }
+                done += static_cast<size_t>(written);
+            }
+            if (m_hasher)
+            {
+                m_hasher->update(buffer.data(), count);
+            }
+            copied += count;
+
+            // A regular file only reads short at its end, so a short read of the size the scan saw
+            // saves the read that would return nothing.  Pseudo files report no size and are read out.
+            if (count < buffer.size() && copied == size && size > 0)
+            {
+                break;
+            }
+        }
+        transfer_timer.stop();
+        notify(copied);
+        m_method = Method::Small;
+
+        if (m_metadata)
+        {
+            // The mode is known from the scan; anything more needs the source's status.
+            PhaseTimings::Timer metadata_timer{m_timings, PhaseTimings::Phase::Chmod};
+            const auto & attributes = m_metadata->attributes();
+            struct stat status
+            {};
+            status.st_mode = static_cast<mode_t>(mode);
+            if ((attributes.times || attributes.ownership || attributes.extended_attributes) &&
+                ::fstat(source.get(), &status) != 0)
+            {
+                throw_errno("unable to stat " + source_path);
+            }
+            m_metadata->apply(source.get(), destination.get(), status, destination_path);
+        }
+
+        PhaseTimings::Timer close_timer{m_timings, PhaseTimings::Phase::Close};
+        source.close();
+        if (destination.close() != 0 && errno != EINTR)
+        {
+            throw_errno("unable to close " + destination_path);
+        }
+    }
+
+    auto FileCopier::method_name(Method method) -> const char *
+    {
+        switch (method)
+        {
+            case Method::None:
+                return "none";
+            case Method::Reflink:
+                return "reflink";
+            case Method::CopyFileRange:
+                return "copy_file_range";
+            case Method::SendFile:
+                return "sendfile";
+            case Method::ReadWrite:
+                return "read/write";
+            case Method::Sparse:
+                return "sparse extents";
+            case Method::Small:
+                return "small read/write";
+            case Method::ItemCopier:
+                return "ItemCopier";
+        }
+        return "unknown";
+    }
+
+    auto FileCopier::cache_mode_name(CacheMode mode) -> const char *
+    {
+        switch (mode)
+        {
+            case CacheMode::Normal:
+                return "normal";
+            case CacheMode::DropBehind:
+                return "drop_behind";
+            case CacheMode::Direct:
+                return "direct";
+        }
+        return "unknown";
+    }
+
+    auto FileCopier::cache_mode_named(const std::string & name, CacheMode & mode) -> bool
+    {
+        std::string lower{name};
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char character) {
+            return static_cast<char>(std::tolower(character));
+        });
+
+        for (auto candidate : {CacheMode::Normal, CacheMode::DropBehind, CacheMode::Direct})
+        {
+            if (lower == cache_mode_name(candidate))
+            {
+                mode = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+#if defined(__linux__)
+
+    auto FileCopier::try_reflink(int source, int destination, size_type size) -> bool
+    {
+        if (size == 0 || ::ioctl(destination, FICLONE, source) != 0)
+        {
+            return false;
+        }
+        notify(size);
+        return true;
+    }
+
+    auto FileCopier::try_copy_file_range(int source, int destination, size_type & offset, size_type end) -> bool
+    {
+        CacheDropper dropper{source, destination, m_cache_mode != CacheMode::Normal};
+        while (offset < end && ! interrupted())
+        {
+            auto source_offset = static_cast<off_t>(offset);
+            auto destination_offset = static_cast<off_t>(offset);
+            const auto length = static_cast<size_t>(std::min<size_type>(kernel_chunk_size, end - offset));
+            const auto copied = ::copy_file_range(source, &source_offset, destination, &destination_offset, length, 0);
+            if (copied < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (is_unsupported_error(errno))
+                {
+                    return false;
+                }
+                throw_errno("copy_file_range failed for " + m_source_path.stlStringInUTF8());
+            }
+            if (copied == 0)
+            {
+                // Some pseudo file systems report a size but return nothing through copy_file_range.
+                return offset > 0;
+            }
+            dropper.written(offset, static_cast<size_type>(copied));
+            offset += static_cast<size_type>(copied);
+            notify(static_cast<size_type>(copied));
+        }
+        return true;
+    }
+
+    auto FileCopier::try_sendfile(int source, int destination, size_type & offset) -> bool
+    {
+        if (::lseek(destination, static_cast<off_t>(offset), SEEK_SET) < 0)
+        {
+            return false;
+        }
+
+        CacheDropper dropper{source, destination, m_cache_mode != CacheMode::Normal};
+        while (! interrupted())
+        {
+            auto source_offset = static_cast<off_t>(offset);
+            const auto copied = ::sendfile(destination, source, &source_offset, kernel_chunk_size);
+            if (copied < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (is_unsupported_error(errno))
+                {
+                    return false;
+                }
+                throw_errno("sendfile failed for " + m_source_path.stlStringInUTF8());
+            }
+            if (copied == 0)
+            {
+                return offset > 0;
+            }
+            dropper.written(offset, static_cast<size_type>(copied));
+            offset += static_cast<size_type>(copied);
+            notify(static_cast<size_type>(copied));
+        }
+        return true;
+    }
+
+    auto FileCopier::copy_extents(int source, int destination, size_type & offset, size_type end, bool punch_holes)
+        -> bool
+    {
+        auto first = true;
+        while (offset < end && ! interrupted())
+        {
+            auto data = ::lseek(source, static_cast<off_t>(offset), SEEK_DATA);
+            if (data < 0)
+            {
+                if (errno != ENXIO)
+                {
+                    if (first && is_unsupported_error(errno))
+                    {
+                        return false;
+                    }
+                    throw_errno("unable to find the data in " + m_source_path.stlStringInUTF8());
+                }
+                // ENXIO: nothing but a hole up to the end of the file.
+                data = static_cast<off_t>(end);
+            }
+            first = false;
+
+            const auto data_start = std::min(static_cast<size_type>(data), end);
+            if (data_start > offset)
+            {
+                skip_hole(destination, offset, data_start, punch_holes);
+                offset = data_start;
+                if (offset >= end)
+                {
+                    break;
+                }
+            }
+
+            const auto hole = ::lseek(source, static_cast<off_t>(offset), SEEK_HOLE);
+            if (hole < 0)
+            {
+                throw_errno("unable to find the holes in " + m_source_path.stlStringInUTF8());
+            }
+
+            const auto data_end = std::min(static_cast<size_type>(hole), end);
+            if (needs_userspace() || ! try_copy_file_range(source, destination, offset, data_end))
+            {
+                read_write(source, destination, offset, data_end);
+            }
+            if (offset < data_end && ! interrupted())
+            {
+                // The source shrank; what is left reads as a hole.
+                skip_hole(destination, offset, data_end, punch_holes);
+                offset = data_end;
+            }
+        }
+        return true;
+    }
+
+    void FileCopier::skip_hole(int destination, size_type offset, size_type end, bool punch_holes)
+    {
+        // A hole reads back as zeros, so that is what the hash sees.
+        for (auto position = offset; m_hasher && position < end; position += zero_buffer.size())
+        {
+            m_hasher->update(zero_buffer.data(),
+                             static_cast<size_t>(std::min<size_type>(zero_buffer.size(), end - position)));
+        }
+
+        if (! punch_holes || ::fallocate(destination, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                         static_cast<off_t>(offset), static_cast<off_t>(end - offset)) == 0)
+        {
+            return;
+        }
+
+        // The file system cannot punch holes; zeros are the next best thing.
+        while (offset < end)
+        {
+            const auto length = static_cast<size_t>(std::min<size_type>(zero_buffer.size(), end - offset));
+            const auto written = ::pwrite(destination, zero_buffer.data(), length, static_cast<off_t>(offset));
+            if (written < 0)
+            {
+                if (errno == EINTR || (errno == EINVAL && has_direct(destination) && set_direct(destination, false)))
+                {
+                    // The zeros are not aligned for O_DIRECT.
+                    continue;
+                }
+                throw_errno("unable to write " + m_destination_path.stlStringInUTF8());
+            }
+            offset += static_cast<size_type>(written);
+        }
+    }
+
+#endif
+
+    auto FileCopier::data_bytes(int descriptor, size_type offset, size_type length) -> size_type
+    {
+#if defined(__linux__)
+        size_type total{0};
+        const auto end = offset + length;
+        while (offset < end)
+        {
+            const auto data = ::lseek(descriptor, static_cast<off_t>(offset), SEEK_DATA);
+            if (data < 0)
+            {
+                // ENXIO means only a hole is left; after any other failure count the rest as data.
+                return errno == ENXIO ? total : total + end - offset;
+            }
+            const auto hole = ::lseek(descriptor, data, SEEK_HOLE);
+            if (hole < 0)
+            {
+                return total + end - offset;
+            }
+            const auto data_start = std::min(static_cast<size_type>(data), end);
+            const auto data_end = std::min(static_cast<size_type>(hole), end);
+            total += data_end - data_start;
+            offset = std::max(data_end, offset + 1);
+        }
+        return total;
+#else
+        (void)descriptor;
+        (void)offset;
+        return length;
+#endif
+    }
+
+    void FileCopier::copy_range(int source, int destination, size_type offset, size_type length)
+    {
+        PhaseTimings::Timer timer{m_timings, PhaseTimings::Phase::Transfer};
+        const auto end = offset + length;
+#if defined(__linux__)
+        // On a dense file this costs two lseek(2) calls and finds a single extent.
+        if (copy_extents(source, destination, offset, end, true))
+        {
+            m_method = Method::Sparse;
+            return;
+        }
+        if (! needs_userspace() && try_copy_file_range(source, destination, offset, end))
+        {
+            m_method = Method::CopyFileRange;
+            return;
+        }
+#endif
+        read_write(source, destination, offset, end);
+        m_method = Method::ReadWrite;
+    }
+
+    void FileCopier::read_write(int source, int destination, size_type & offset, size_type end)
+    {
+        BufferPool local_pool{};
+        auto & pool = m_buffer_pool ? *m_buffer_pool : local_pool;
+        const auto buffer = pool.acquire(end - offset);
+
+        // An unaligned start, or a file system without O_DIRECT, drops behind instead.
+        auto direct = m_cache_mode == CacheMode::Direct && offset % direct_alignment == 0 &&
+                      start_direct(source, destination);
+        if (m_cache_mode == CacheMode::Direct && ! direct)
+        {
+            stop_direct(source, destination);
+        }
+        // Direct I/O leaves nothing to drop, but a fallback halfway through would.
+        CacheDropper dropper{source, destination, m_cache_mode != CacheMode::Normal};
+
+        while (offset < end && ! interrupted())
+        {
+            const auto start = BufferPool::clock_type::now();
+            auto length = std::min<size_type>(buffer.size(), end - offset);
+            if (direct)
+            {
+                // Past the end of the file a direct read comes back short, which is how the tail shows.
+                length = std::min<size_type>(buffer.size(), round_up_to_direct(length));
+            }
+            const auto bytes_read =
+                ::pread(source, buffer.data(), static_cast<size_t>(length), static_cast<off_t>(offset));
+            if (bytes_read < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EINVAL && direct && stop_direct(source, destination))
+                {
+                    direct = false;
+                    continue;
+                }
+                throw_errno("unable to read " + m_source_path.stlStringInUTF8());
+            }
+            if (bytes_read == 0)
+            {
+                return;
+            }
+
+            // A direct read may run past the end of the range; those bytes belong to someone else.
+            const auto count = std::min<size_type>(static_cast<size_type>(bytes_read), end - offset);
+            auto write_length = count;
+            auto padded = false;
+            if (direct && count % direct_alignment != 0)
+            {
+                if (count < length && count == static_cast<size_type>(bytes_read))
+                {
+                    // The tail of the file: write whole blocks and cut the padding off afterwards.
+                    write_length = round_up_to_direct(count);
+                    std::memset(buffer.data() + count, 0, static_cast<size_t>(write_length - count));
+                    padded = true;
+                }
+                else
+                {
+                    // An unaligned end inside the file; the rest goes through the cache.
+                    stop_direct(source, destination);
+                    direct = false;
+                }
+            }
+
+            size_type done{0};
+            while (done < write_length)
+            {
+                const auto remaining = static_cast<size_t>(write_length - done);
+                const auto written =
+                    ::pwrite(destination, buffer.data() + done, remaining, static_cast<off_t>(offset + done));
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (errno == EINVAL && direct && stop_direct(source, destination))
+                    {
+                        direct = false;
+                        write_length = count;
+                        padded = false;
+                        continue;
+                    }
+                    throw_errno("unable to write " + m_destination_path.stlStringInUTF8());
+                }
+                done += static_cast<size_type>(written);
+            }
+            if (padded && ::ftruncate(destination, static_cast<off_t>(offset + count)) != 0)
+            {
+                throw_errno("unable to size " + m_destination_path.stlStringInUTF8());
+            }
+
+            pool.record(buffer.size(), count, BufferPool::clock_type::now() - start);
+            dropper.written(offset, count);
+            offset += count;
+
+            // The pages are already on their way to the destination; hash while writeback runs.
+            if (m_hasher)
+            {
+                m_hasher->update(buffer.data(), static_cast<size_t>(count));
+            }
+            notify(count);
+        }
+    }
+
+} // namespace copy
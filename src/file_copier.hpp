@@ -0,0 +1,252 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef FILE_COPIER_HPP
+#define FILE_COPIER_HPP
+
+#include <functional>
+#include <string>
+#include "TFFoundation.hpp"
+#include "buffer_pool.hpp"
+#include "content_hash.hpp"
+#include "metadata_copier.hpp"
+#include "phase_timings.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    /**
+     * @brief class to copy the data of one regular file.
+     *
+     * On Linux the copier hands the work to the kernel.  It tries, in order, a reflink
+     * (ioctl(FICLONE)), copy_file_range(2), sendfile(2), and finally a plain read/write loop.  Each
+     * step picks up at the offset where the previous one gave up.  A sparse source is copied extent
+     * by extent instead: lseek(2) with SEEK_DATA and SEEK_HOLE finds the data, and the holes are
+     * left unwritten so the destination stays sparse.  Progress counts only the data, never the
+     * holes.  On other platforms the copier uses ItemCopier.  Progress and interruption work like
+     * they do in ItemCopier.
+     *
+     * With a hasher set, the data has to pass through userspace, so the copier goes straight to the
+     * read/write loop and hashes each buffer after writing it.  The source is read once, and the
+     * hash runs while the kernel writes the previous buffers back.
+     *
+     * The cache mode keeps a long copy from filling the page cache.  DropBehind starts writeback as
+     * each chunk is written, then drops the chunk from the cache once the next one is on its way.
+     * Direct reads and writes with O_DIRECT through the read/write loop.  The buffers are
+     * page-aligned, and an unaligned tail is written padded and then truncated.  File systems that
+     * refuse O_DIRECT get DropBehind instead.  Reflinks share the source's blocks and skip the
+     * cache either way.
+     */
+    class FileCopier
+    {
+    public:
+        using size_type = uint64_t;
+        using notifier_type = ItemCopier::notifier_type;
+        using interrupter_type = std::function<bool()>;
+
+        enum class Method
+        {
+            None,
+            Reflink,
+            CopyFileRange,
+            SendFile,
+            ReadWrite,
+            Sparse,
+            Small,
+            ItemCopier
+        };
+
+        enum class CacheMode
+        {
+            Normal,
+            DropBehind,
+            Direct
+        };
+
+        // The largest file copy_small() reads in one call.
+        static constexpr size_type small_file_size{64 * 1024};
+
+        FileCopier(const String & source, const String & destination);
+
+        void set_notifier(notifier_type notifier)
+        {
+            m_notifier = std::move(notifier);
+        }
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to record how long each phase takes in @e timings, which must outlive this
+         * object.
+         */
+        void set_timings(PhaseTimings * timings)
+        {
+            m_timings = timings;
+        }
+
+        /**
+         * @brief method to take read/write buffers from @e pool, which must outlive this object, and
+         * to report their throughput to it.  Without a pool each copy allocates its own buffer.
+         */
+        void set_buffer_pool(BufferPool * pool)
+        {
+            m_buffer_pool = pool;
+        }
+
+        /**
+         * @brief method to feed every byte copied to @e hasher, which must outlive this object.
+         * Pass nullptr to let the kernel move the data again.
+         */
+        void set_hasher(ContentHasher * hasher)
+        {
+            m_hasher = hasher;
+        }
+
+        /**
+         * @brief method to have copy() finish with @e metadata, which must outlive this object, on
+         * the descriptors it has open.  copy_range() leaves the metadata to its caller.
+         */
+        void set_metadata(const MetadataCopier * metadata)
+        {
+            m_metadata = metadata;
+        }
+
+        /**
+         * @brief method to keep the copied data out of the page cache with @e mode.  Only Linux
+         * honors it.
+         */
+        void set_cache_mode(CacheMode mode)
+        {
+            m_cache_mode = mode;
+        }
+
+        /**
+         * @brief method to copy the file.  Throws std::system_error if the copy fails.
+         */
+        void copy();
+
+        /**
+         * @brief method to copy a file of at most small_file_size bytes with one read and one write
+         * through a stack buffer, skipping the probing copy() does for the kernel data paths.
+         * Progress is reported once, at the end.  @e size and @e mode come from the scan; a file
+         * that has grown since is still copied whole.  Holes are written out and the cache mode is
+         * ignored, so sparse files and cache modes other than Normal belong to copy().  Throws
+         * std::system_error if the copy fails.
+         */
+        void copy_small(size_type size, uint32_t mode);
+
+        /**
+         * @return the last data path used by copy() or copy_small().
+         */
+        [[nodiscard]] auto method() const -> Method
+        {
+            return m_method;
+        }
+
+        /**
+         * @brief method to copy the byte range [offset, offset + length) between two open files with
+         * positional I/O.  Several copiers can work on different ranges of the same pair of
+         * descriptors at once.  Holes in the source range are punched in the destination, which
+         * may hold data from an earlier run.  Throws std::system_error if the copy fails.
+         */
+        void copy_range(int source, int destination, size_type offset, size_type length);
+
+        /**
+         * @return the bytes of data, as opposed to holes, in the range [offset, offset + length) of
+         * the open file @e descriptor.
+         */
+        [[nodiscard]] static auto data_bytes(int descriptor, size_type offset, size_type length) -> size_type;
+
+        [[nodiscard]] static auto method_name(Method method) -> const char *;
+
+        [[nodiscard]] static auto cache_mode_name(CacheMode mode) -> const char *;
+
+        /**
+         * @brief method to look up a cache mode by name (normal, drop_behind or direct), ignoring case.
+         * @return false if @e name is not a mode; @e mode is then unchanged.
+         */
+        static auto cache_mode_named(const std::string & name, CacheMode & mode) -> bool;
+
+    private:
+        String m_source_path{};
+        String m_destination_path{};
+        notifier_type m_notifier{};
+        interrupter_type m_interrupter{};
+        Method m_method{Method::None};
+        PhaseTimings * m_timings{nullptr};
+        ContentHasher * m_hasher{nullptr};
+        BufferPool * m_buffer_pool{nullptr};
+        CacheMode m_cache_mode{CacheMode::Normal};
+        const MetadataCopier * m_metadata{nullptr};
+
+        [[nodiscard]] auto interrupted() const -> bool
+        {
+            return m_interrupter && m_interrupter();
+        }
+
+        void notify(size_type bytes) const
+        {
+            if (m_notifier)
+            {
+                m_notifier(bytes);
+            }
+        }
+
+        // Hashing and O_DIRECT both need the data in userspace, which rules out the kernel copy paths.
+        [[nodiscard]] auto needs_userspace() const -> bool
+        {
+            return m_hasher || m_cache_mode == CacheMode::Direct;
+        }
+
+#if defined(__linux__)
+        auto try_reflink(int source, int destination, size_type size) -> bool;
+
+        auto try_copy_file_range(int source, int destination, size_type & offset, size_type end) -> bool;
+
+        auto try_sendfile(int source, int destination, size_type & offset) -> bool;
+
+        /**
+         * @brief method to copy the data extents in [offset, end) and skip the holes, punching them
+         * in the destination if @e punch_holes is set.
+         * @return false, before copying anything, if the file system cannot report extents.
+         */
+        auto copy_extents(int source, int destination, size_type & offset, size_type end, bool punch_holes) -> bool;
+
+        void skip_hole(int destination, size_type offset, size_type end, bool punch_holes);
+#endif
+
+        void read_write(int source, int destination, size_type & offset, size_type end);
+    };
+
+} // namespace copy
+
+#endif // FILE_COPIER_HPP
@@ -0,0 +1,109 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef FILE_DESCRIPTOR_HPP
+#define FILE_DESCRIPTOR_HPP
+
+#include <unistd.h>
+
+namespace copy
+{
+
+    /**
+     * @brief class that owns a POSIX file descriptor and closes it when destroyed.
+     */
+    class FileDescriptor
+    {
+    public:
+        FileDescriptor() = default;
+
+        explicit FileDescriptor(int descriptor) : m_descriptor{descriptor} {}
+
+        FileDescriptor(const FileDescriptor &) = delete;
+
+        FileDescriptor & operator=(const FileDescriptor &) = delete;
+
+        FileDescriptor(FileDescriptor && other) noexcept : m_descriptor{other.release()} {}
+
+        FileDescriptor & operator=(FileDescriptor && other) noexcept
+        {
+            if (this != &other)
+            {
+                reset(other.release());
+            }
+            return *this;
+        }
+
+        ~FileDescriptor()
+        {
+            reset();
+        }
+
+        [[nodiscard]] auto get() const -> int
+        {
+            return m_descriptor;
+        }
+
+        [[nodiscard]] auto is_valid() const -> bool
+        {
+            return m_descriptor >= 0;
+        }
+
+        /**
+         * @brief method to close the descriptor and report the result, for callers that need to see
+         * deferred write errors.
+         */
+        auto close() -> int
+        {
+            const auto result = ::close(m_descriptor);
+            m_descriptor = -1;
+            return result;
+        }
+
+        auto release() -> int
+        {
+            const auto descriptor = m_descriptor;
+            m_descriptor = -1;
+            return descriptor;
+        }
+
+        void reset(int descriptor = -1)
+        {
+            if (m_descriptor >= 0)
+            {
+                ::close(m_descriptor);
+            }
+            m_descriptor = descriptor;
+        }
+
+    private:
+        int m_descriptor{-1};
+    };
+
+} // namespace copy
+
+#endif // FILE_DESCRIPTOR_HPP
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include "file_inventory.hpp"
+
+namespace copy
+{
+
+    auto FileInventory::add_item_at_path(const std::string & path, std::string::size_type relative_offset)
+        -> std::optional<Entry>
+    {
+        struct stat status
+        {};
+        if (::stat(path.c_str(), &status) != 0)
+        {
+            return std::nullopt;
+        }
+
+        auto relative_path = std::string_view{path};
+        relative_path.remove_prefix(std::min(relative_offset, relative_path.size()));
+        return add(relative_path, status);
+    }
+
+    auto FileInventory::add(std::string_view relative_path, const struct stat & status) -> Entry
+    {
+        auto entry = make_entry(status);
+        entry.path_length = static_cast<uint32_t>(relative_path.size());
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            entry.path_offset = m_path_arena.size();
+            m_path_arena.append(relative_path);
+            m_entries.push_back(entry);
+        }
+        m_entry_added.notify_all();
+
+        return entry;
+    }
+
+    auto FileInventory::Batch::add(std::string_view relative_path, const struct stat & status) -> const Entry &
+    {
+        auto & entry = m_entries.emplace_back(make_entry(status));
+        entry.path_offset = m_paths.size();
+        entry.path_length = static_cast<uint32_t>(relative_path.size());
+        m_paths.append(relative_path);
+        return entry;
+    }
+
+    void FileInventory::add(Batch & batch)
+    {
+        if (batch.empty())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const auto base_offset = m_path_arena.size();
+            m_path_arena.append(batch.m_paths);
+            m_entries.reserve(m_entries.size() + batch.m_entries.size());
+            for (auto entry : batch.m_entries)
+            {
+                entry.path_offset += base_offset;
+                m_entries.push_back(entry);
+            }
+        }
+        m_entry_added.notify_all();
+
+        batch.m_entries.clear();
+        batch.m_paths.clear();
+    }
+
+    void FileInventory::mark_complete()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_complete = true;
+        }
+        m_entry_added.notify_all();
+    }
+
+    auto FileInventory::wait_for_entry(index_type index, Entry & entry, std::string & relative_path) -> bool
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_entry_added.wait(lock, [this, index] {
+            return index < m_entries.size() || m_complete;
+        });
+
+        if (index >= m_entries.size())
+        {
+            return false;
+        }
+
+        entry = m_entries[index];
+        relative_path.assign(m_path_arena, entry.path_offset, entry.path_length);
+        return true;
+    }
+
+    auto FileInventory::would_wait_for(index_type index) const -> bool
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return index >= m_entries.size() && ! m_complete;
+    }
+
+    auto FileInventory::size() const -> index_type
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_entries.size();
+    }
+
+    auto FileInventory::is_complete() const -> bool
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_complete;
+    }
+
+    void FileInventory::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_path_arena.clear();
+        m_complete = false;
+    }
+
+    auto FileInventory::make_entry(const struct stat & status) -> Entry
+    {
+        Entry entry{};
+        entry.size = static_cast<size_type>(status.st_size);
+        // st_blocks is in 512 byte units whatever the file system's block size.  Compressed files also
+        // report fewer blocks than their size; they are counted short like sparse ones.
+        entry.allocated_size = std::min(entry.size, static_cast<size_type>(status.st_blocks) * 512);
+        entry.modification_time = modification_time(status);
+        entry.device = static_cast<uint64_t>(status.st_dev);
+        entry.inode = static_cast<uint64_t>(status.st_ino);
+        entry.mode = static_cast<uint32_t>(status.st_mode);
+        entry.link_count = static_cast<uint32_t>(status.st_nlink);
+        entry.type = type_from_mode(entry.mode);
+        return entry;
+    }
+
+    auto FileInventory::modification_time(const struct stat & status) -> int64_t
+    {
+#if defined(__APPLE__)
+        return static_cast<int64_t>(status.st_mtimespec.tv_sec) * 1'000'000'000 +
+               static_cast<int64_t>(status.st_mtimespec.tv_nsec);
+#else
+        return static_cast<int64_t>(status.st_mtim.tv_sec) * 1'000'000'000 +
+               static_cast<int64_t>(status.st_mtim.tv_nsec);
+#endif
+    }
+
+    auto FileInventory::type_from_mode(uint32_t mode) -> EntryType
+    {
+        switch (mode & S_IFMT)
+        {
+            case S_IFREG:
+                return EntryType::File;
+            case S_IFDIR:
+                return EntryType::Directory;
+            case S_IFLNK:
+                return EntryType::Symlink;
+            default:
+                return EntryType::Other;
+        }
+    }
+
+} // namespace copy
@@ -0,0 +1,197 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef FILE_INVENTORY_HPP
+#define FILE_INVENTORY_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+
+namespace copy
+{
+
+    /**
+     * @brief class that records one stat of every item found by the scan so the copy never has to
+     * stat the source again.
+     *
+     * Entries live in one flat array.  Paths are stored relative to the source root in a shared
+     * string arena and entries refer to them by offset and length.  The scan appends entries while
+     * the copy reads them, so the copy can start before the scan finishes (see
+     * DataModel::stream_copy).  A directory is always added before anything inside it.
+     */
+    class FileInventory
+    {
+    public:
+        using size_type = uint64_t;
+        using index_type = size_t;
+
+        enum class EntryType : uint8_t
+        {
+            File,
+            Directory,
+            Symlink,
+            Other
+        };
+
+        struct Entry
+        {
+            size_type path_offset{0};
+            size_type size{0};
+            // The bytes the item occupies on disk, at most size: the data a copy moves and what the
+            // progress totals count.  Less than size for a sparse file, whose holes are skipped.
+            size_type allocated_size{0};
+            int64_t modification_time{0}; // nanoseconds since the epoch
+            uint64_t device{0};
+            uint64_t inode{0};
+            uint32_t path_length{0};
+            uint32_t mode{0};
+            uint32_t link_count{1};
+            EntryType type{EntryType::Other};
+        };
+
+        /**
+         * @brief struct that tells items apart by their device and inode numbers.  The names of a
+         * hard linked file share one identity.
+         */
+        struct Identity
+        {
+            uint64_t device{0};
+            uint64_t inode{0};
+
+            auto operator==(const Identity & other) const -> bool = default;
+
+            struct Hash
+            {
+                auto operator()(const Identity & identity) const -> size_t
+                {
+                    return std::hash<uint64_t>{}(identity.inode * 31 + identity.device);
+                }
+            };
+        };
+
+        [[nodiscard]] static auto identity_of(const Entry & entry) -> Identity
+        {
+            return Identity{entry.device, entry.inode};
+        }
+
+        /**
+         * @brief method to stat an item and add it to the inventory.
+         * @param path the full path of the item.
+         * @param relative_offset the index in @e path where the path relative to the source root
+         * starts.
+         * @return the new entry, or an empty optional if the item could not be stat'ed.
+         */
+        auto add_item_at_path(const std::string & path, std::string::size_type relative_offset)
+            -> std::optional<Entry>;
+
+        auto add(std::string_view relative_path, const struct stat & status) -> Entry;
+
+        /**
+         * @brief class that collects entries so a scanning thread can append a whole directory under
+         * one lock.
+         */
+        class Batch
+        {
+        public:
+            auto add(std::string_view relative_path, const struct stat & status) -> const Entry &;
+
+            [[nodiscard]] auto entries() const -> const std::vector<Entry> &
+            {
+                return m_entries;
+            }
+
+            [[nodiscard]] auto empty() const -> bool
+            {
+                return m_entries.empty();
+            }
+
+        private:
+            std::vector<Entry> m_entries{};
+            std::string m_paths{};
+
+            friend class FileInventory;
+        };
+
+        /**
+         * @brief method to append every entry in @e batch, in order, and empty the batch.
+         */
+        void add(Batch & batch);
+
+        /**
+         * @brief method to tell readers that the scan has finished adding entries.
+         */
+        void mark_complete();
+
+        /**
+         * @brief method to fetch an entry, waiting for the scan to add it if necessary.
+         * @param index the index of the entry.
+         * @param entry the entry, on success.
+         * @param relative_path the path of the entry relative to the source root, on success.
+         * @return false if the scan finished without adding an entry at @e index.
+         */
+        auto wait_for_entry(index_type index, Entry & entry, std::string & relative_path) -> bool;
+
+        /**
+         * @return true if wait_for_entry() would block for the entry at @e index, because the scan
+         * has neither added it yet nor finished.
+         */
+        [[nodiscard]] auto would_wait_for(index_type index) const -> bool;
+
+        [[nodiscard]] auto size() const -> index_type;
+
+        [[nodiscard]] auto is_complete() const -> bool;
+
+        void clear();
+
+        [[nodiscard]] static auto type_from_mode(uint32_t mode) -> EntryType;
+
+        /**
+         * @return the modification time in @e status as nanoseconds since the epoch.
+         */
+        [[nodiscard]] static auto modification_time(const struct stat & status) -> int64_t;
+
+    private:
+        [[nodiscard]] static auto make_entry(const struct stat & status) -> Entry;
+
+        std::vector<Entry> m_entries{};
+        std::string m_path_arena{};
+        bool m_complete{false};
+
+        mutable std::mutex m_mutex{};
+        std::condition_variable m_entry_added{};
+    };
+
+} // namespace copy
+
+#endif // FILE_INVENTORY_HPP
@@ -0,0 +1,223 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+#include "headless_copy.hpp"
+#include "copy_operation.hpp"
+#include "utilities.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        volatile std::sig_atomic_t stop_requested{0};
+
+        extern "C" void request_stop(int)
+        {
+            stop_requested = 1;
+        }
+    } // namespace
+
+    HeadlessCopy::HeadlessCopy(DataModel & model) : m_model{model}, m_progress{model.copy_jobs + 1} {}
+
+    auto HeadlessCopy::run() -> int
+    {
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+
+        m_start_time = std::chrono::steady_clock::now();
+
+        CopyOperation operation{m_model};
+        operation.set_progress_callback([this](auto &, auto bytes) {
+            m_progress.add_bytes_copied(bytes);
+        });
+        operation.set_file_finished_callback([this](auto &) {
+            m_progress.add_file_copied();
+        });
+        operation.set_file_skipped_callback([this](auto & job) {
+            m_progress.add_file_skipped(job.allocated_size);
+        });
+        operation.set_error_callback([this](auto & message) {
+            report_error(message);
+        });
+        operation.set_mismatch_callback([this](auto & message) {
+            report_mismatch(message);
+        });
+        operation.set_interrupter([this]() -> bool {
+            return is_interrupted();
+        });
+
+        std::thread reporter{[this] {
+            std::unique_lock<std::mutex> lock(m_finished_mutex);
+            while (! m_finished_condition.wait_for(lock, m_model.progress_interval, [this] {
+                return m_finished;
+            }))
+            {
+                report_progress(m_model.verifying ? "verify" : (m_model.scan_complete ? "copy" : "scan"));
+            }
+        }};
+
+        bool copied{false};
+        if (m_model.stream_copy)
+        {
+            std::thread copier{[&operation, &copied] {
+                copied = operation.copy();
+            }};
+            operation.scan();
+            copier.join();
+        }
+        else
+        {
+            operation.scan();
+            if (! is_interrupted())
+            {
+                copied = operation.copy();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_finished_mutex);
+            m_finished = true;
+        }
+        m_finished_condition.notify_all();
+        reporter.join();
+
+        const auto status = copied ? 0 : (is_interrupted() ? 2 : 1);
+        report_progress("done", status == 0 ? "ok" : (status == 2 ? "interrupted" : "error"));
+        return status;
+    }
+
+    void HeadlessCopy::report_progress(const char * phase, const char * status)
+    {
+        const auto elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start_time).count();
+        const auto progress = m_progress.totals();
+        const auto bytes_copied = progress.bytes_copied;
+        const auto bytes_skipped = progress.bytes_skipped;
+        const auto total_bytes = m_model.total_bytes.load();
+        const auto rate = elapsed > 0 ? static_cast<double>(bytes_copied) / elapsed : 0.0;
+        const auto bytes_remaining =
+            total_bytes > bytes_copied + bytes_skipped ? total_bytes - bytes_copied - bytes_skipped : 0;
+
+        char buffer[512]{};
+        std::snprintf(buffer, sizeof(buffer),
+                      "{\"phase\":\"%s\",\"elapsed\":%.3f,\"files\":%llu,\"files_total\":%llu,\"bytes\":%llu,"
+                      "\"bytes_total\":%llu,\"files_skipped\":%llu,\"bytes_skipped\":%llu,\"rate\":%.1f,",
+                      phase, elapsed, static_cast<unsigned long long>(progress.files_copied),
+                      static_cast<unsigned long long>(m_model.total_files.load()),
+                      static_cast<unsigned long long>(bytes_copied), static_cast<unsigned long long>(total_bytes),
+                      static_cast<unsigned long long>(progress.files_skipped),
+                      static_cast<unsigned long long>(bytes_skipped), rate);
+        std::string line{buffer};
+
+        // Until the scan finishes the totals are lower bounds, and so is the estimate.  A limit caps
+        // the rate the estimate assumes.
+        const auto files_done = progress.files_copied + progress.files_skipped;
+        const auto files_total = m_model.total_files.load();
+        const auto eta = m_model.throttle.estimate_seconds(
+            bytes_remaining, files_total > files_done ? files_total - files_done : 0, rate);
+        if (eta >= 0)
+        {
+            std::snprintf(buffer, sizeof(buffer), "\"eta\":%.1f,", eta);
+            line += buffer;
+        }
+        else
+        {
+            line += "\"eta\":null,";
+        }
+
+        std::snprintf(buffer, sizeof(buffer),
+                      "\"scan_complete\":%s,\"errors\":%llu,\"mismatches\":%llu,\"rate_limit\":%llu,"
+                      "\"file_rate_limit\":%llu",
+                      m_model.scan_complete ? "true" : "false", static_cast<unsigned long long>(m_errors.load()),
+                      static_cast<unsigned long long>(m_mismatches.load()),
+                      static_cast<unsigned long long>(m_model.throttle.bytes_per_second()),
+                      static_cast<unsigned long long>(m_model.throttle.files_per_second()));
+        line += buffer;
+
+        if (status != nullptr)
+        {
+            line += ",\"status\":\"";
+            line += status;
+            line += "\"";
+        }
+        line += "}\n";
+        write_line(line);
+    }
+
+    void HeadlessCopy::report_error(const String & message)
+    {
+        m_errors += 1;
+
+        std::string line{"{\"phase\":\"error\",\"message\":"};
+        append_json_string(line, message.stlStringInUTF8());
+        line += "}\n";
+        write_line(line);
+    }
+
+    void HeadlessCopy::report_mismatch(const String & message)
+    {
+        m_mismatches += 1;
+
+        std::string line{"{\"phase\":\"mismatch\",\"message\":"};
+        append_json_string(line, message.stlStringInUTF8());
+        line += "}\n";
+        write_line(line);
+    }
+
+    void HeadlessCopy::write_line(const std::string & line)
+    {
+        std::lock_guard<std::mutex> lock(m_output_mutex);
+        const char * data = line.data();
+        auto remaining = line.size();
+        while (remaining > 0)
+        {
+            const auto written = ::write(m_model.progress_descriptor, data, remaining);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return;
+            }
+            data += written;
+            remaining -= static_cast<size_t>(written);
+        }
+    }
+
+    auto HeadlessCopy::is_interrupted() const -> bool
+    {
+        return stop_requested != 0;
+    }
+
+} // namespace copy
@@ -0,0 +1,96 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef HEADLESS_COPY_HPP
+#define HEADLESS_COPY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include "TFFoundation.hpp"
+#include "data_model.hpp"
+#include "progress_counters.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    /**
+     * @brief class that runs a copy without the UI and reports progress as JSON lines.
+     *
+     * Every DataModel::progress_interval a line like
+     *
+     *     {"phase":"copy","elapsed":12.0,"files":120,"files_total":3000,"bytes":...,"errors":0,...}
+     *
+     * is written to DataModel::progress_descriptor.  Errors, and files that fail verification, are
+     * written as soon as they happen, and a last line with "phase":"done" and the final status ends
+     * the report.  SIGINT and SIGTERM stop
+     * the copy cleanly so the journal is written out and the copy can be resumed.
+     */
+    class HeadlessCopy
+    {
+    public:
+        using size_type = uint64_t;
+
+        explicit HeadlessCopy(DataModel & model);
+
+        /**
+         * @brief method to run the scan and the copy.  Blocks until both finish.
+         * @return the exit status for the process: 0 on success, 1 after an error, 2 if interrupted.
+         */
+        auto run() -> int;
+
+    private:
+        DataModel & m_model;
+
+        ProgressCounters m_progress;
+        std::atomic<size_type> m_errors{0};
+        std::atomic<size_type> m_mismatches{0};
+
+        std::chrono::steady_clock::time_point m_start_time{};
+        bool m_finished{false};
+        std::mutex m_finished_mutex{};
+        std::condition_variable m_finished_condition{};
+        std::mutex m_output_mutex{};
+
+        void report_progress(const char * phase, const char * status = nullptr);
+
+        void report_error(const String & message);
+
+        void report_mismatch(const String & message);
+
+        void write_line(const std::string & line);
+
+        [[nodiscard]] auto is_interrupted() const -> bool;
+    };
+
+} // namespace copy
+
+#endif // HEADLESS_COPY_HPP
@@ -0,0 +1,136 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "file_copier.hpp"
+#include "link_tracker.hpp"
+
+namespace copy
+{
+
+    auto LinkTracker::earlier_copy(const Identity & identity, const std::string & destination) -> const std::string *
+    {
+        const auto [copy, inserted] = m_copies.emplace(identity, destination);
+        return inserted ? nullptr : &copy->second;
+    }
+
+    void LinkTracker::defer_link(Method method, std::string source, std::string target, std::string destination)
+    {
+        m_links.push_back(Link{method, std::move(source), std::move(target), std::move(destination)});
+    }
+
+    auto LinkTracker::create_links(const MetadataCopier & metadata, const error_callback_type & on_error)
+        -> size_type
+    {
+        size_type failures{0};
+        for (const auto & link : m_links)
+        {
+            if (interrupted())
+            {
+                break;
+            }
+            if (link.method == Method::Hard && make_hard_link(link) == 0)
+            {
+                continue;
+            }
+
+            const auto reason = make_clone(link, metadata);
+            if (! reason.empty())
+            {
+                failures++;
+                if (on_error)
+                {
+                    on_error("Error linking " + link.destination + " to " + link.target + ": " + reason);
+                }
+            }
+        }
+        m_links.clear();
+        return failures;
+    }
+
+    auto LinkTracker::make_hard_link(const Link & link) -> int
+    {
+        const auto * target = link.target.c_str();
+        const auto * destination = link.destination.c_str();
+        if (::link(target, destination) == 0)
+        {
+            return 0;
+        }
+        if (errno != EEXIST)
+        {
+            return errno;
+        }
+
+        // A resumed or synced copy may find the link already made.
+        struct stat target_status
+        {};
+        struct stat destination_status
+        {};
+        if (::lstat(target, &target_status) == 0 && ::lstat(destination, &destination_status) == 0 &&
+            target_status.st_dev == destination_status.st_dev && target_status.st_ino == destination_status.st_ino)
+        {
+            return 0;
+        }
+        if (::unlink(destination) != 0 || ::link(target, destination) != 0)
+        {
+            return errno;
+        }
+        return 0;
+    }
+
+    auto LinkTracker::make_clone(const Link & link, const MetadataCopier & metadata) -> std::string
+    {
+        // The copy truncates its destination, which may still be a hard link to the target.
+        if (::unlink(link.destination.c_str()) != 0 && errno != ENOENT)
+        {
+            return std::strerror(errno);
+        }
+
+        try
+        {
+            FileCopier copier{String{link.target.c_str()}, String{link.destination.c_str()}};
+            copier.copy();
+        }
+        catch (std::exception & e)
+        {
+            return e.what();
+        }
+
+        struct stat status
+        {};
+        if (::lstat(link.source.c_str(), &status) == 0)
+        {
+            metadata.apply(link.source, link.destination, status);
+        }
+        return {};
+    }
+
+} // namespace copy
@@ -0,0 +1,120 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef LINK_TRACKER_HPP
+#define LINK_TRACKER_HPP
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "file_inventory.hpp"
+#include "metadata_copier.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that remembers where items were copied, so a later item with the same identity
+     * can be linked to that copy instead of copied again.
+     *
+     * The links are made once the copy has finished and every file they point to is complete.
+     * Whatever is at a link's destination is replaced.  A hard link the file system refuses, for
+     * instance because the file has reached its link limit, is made as a clone instead.  A clone
+     * goes through FileCopier, so it shares the blocks where the file system can reflink and is a
+     * full copy of the destination file where it cannot.  Not thread safe.
+     */
+    class LinkTracker
+    {
+    public:
+        using size_type = uint64_t;
+        using Identity = FileInventory::Identity;
+        using error_callback_type = std::function<void(const std::string & message)>;
+        using interrupter_type = std::function<bool()>;
+
+        enum class Method
+        {
+            Hard,
+            Clone
+        };
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to look up where an earlier item with @e identity was copied.  The first
+         * time an identity comes up, @e destination is recorded for it instead.
+         * @return the earlier destination, or nullptr if @e destination was recorded.
+         */
+        auto earlier_copy(const Identity & identity, const std::string & destination) -> const std::string *;
+
+        /**
+         * @brief method to make @e destination a link to @e target once the copy is done.  A clone
+         * gets the metadata of @e source, the item it stands for.
+         */
+        void defer_link(Method method, std::string source, std::string target, std::string destination);
+
+        /**
+         * @brief method to make every deferred link and forget them.
+         * @return the number of links that could not be made; each one was passed to @e on_error.
+         */
+        auto create_links(const MetadataCopier & metadata, const error_callback_type & on_error) -> size_type;
+
+    private:
+        struct Link
+        {
+            Method method{Method::Hard};
+            std::string source{};
+            std::string target{};
+            std::string destination{};
+        };
+
+        std::unordered_map<Identity, std::string, Identity::Hash> m_copies{};
+        std::vector<Link> m_links{};
+        interrupter_type m_interrupter{};
+
+        /**
+         * @return zero, or the errno of the failure.
+         */
+        static auto make_hard_link(const Link & link) -> int;
+
+        /**
+         * @return an empty string, or the reason for the failure.
+         */
+        static auto make_clone(const Link & link, const MetadataCopier & metadata) -> std::string;
+
+        [[nodiscard]] auto interrupted() const -> bool
+        {
+            return m_interrupter && m_interrupter();
+        }
+    };
+
+} // namespace copy
+
+#endif // LINK_TRACKER_HPP
@@ -27,6 +27,7 @@
 
 #include <functional>
 #include "loading_panel.hpp"
+#include "copy_operation.hpp"
 #include "utilities.hpp"
 
 namespace copy
@@ -52,7 +53,8 @@ namespace copy
         auto stl_text = box_text.stlStringInUTF8();
         auto formatted_total_bytes = format_total_bytes(static_cast<double>(m_model.total_bytes));
         auto counter_text =
-            String::initWithFormat("total files: %u   total bytes: %@", m_model.total_files, &formatted_total_bytes);
+            String::initWithFormat("total files: %u   total bytes: %@", m_model.total_files.load(),
+                                   &formatted_total_bytes);
 
         auto top_box = hbox({filler(), text(stl_text) | color(m_model.text_color), separator(),
                              spinner(m_spinner_charset, m_spinner_index) | color(m_model.text_color)});
@@ -87,41 +89,29 @@ namespace copy
 
         if (! m_load_thread_started)
         {
-            std::function<void()> load_function{};
-
-            if (m_model.file_manager.fileExistsAtPath(m_model.source_path))
-            {
-                load_function = [this]() {
-                    m_model.total_files = 1;
-                    const auto properties = m_model.file_manager.propertiesForItemAtPath(m_model.source_path);
-                    m_model.total_bytes = properties.size;
+            std::function<void()> load_function = [this]() {
+                const auto single_file = m_model.file_manager.fileExistsAtPath(m_model.source_path);
+                if (m_model.stream_copy && ! single_file)
+                {
+                    // Start copying now; the scan below keeps growing the totals the copy panel shows.
                     m_copy_panel->Refresh();
                     m_model.set_current_panel(DataModel::ActivePanel::COPY);
-                    m_load_thread_finished = true;
-                };
-            }
-            else if (m_model.file_manager.directoryExistsAtPath(m_model.source_path))
-            {
-                load_function = [this]() {
-                    m_model.file_manager.walkItemsAtPath(
-                        true, m_model.source_path, [this](const String & path) -> bool {
-                            // Ignore directories, only look for actual files.
-                            if (m_model.file_manager.directoryExistsAtPath(path))
-                            {
-                                return true;
-                            }
+                    m_screen.PostEvent(Event::Custom);
+                }
+
+                CopyOperation operation{m_model};
+                operation.set_interrupter([this]() -> bool {
+                    return m_interrupted;
+                });
+                operation.scan();
 
-                            auto properties = m_model.file_manager.propertiesForItemAtPath(path);
-                            m_model.total_bytes += properties.size;
-                            m_model.total_files += 1;
-                            return true;
-                        });
-                    m_model.bytes_remaining = m_model.total_bytes;
+                if (! m_model.stream_copy || single_file)
+                {
                     m_copy_panel->Refresh();
                     m_model.set_current_panel(DataModel::ActivePanel::COPY);
-                    m_load_thread_finished = true;
-                };
-            }
+                }
+                m_load_thread_finished = true;
+            };
 
             std::thread load_thread{load_function};
             load_thread.detach();
@@ -31,6 +31,7 @@
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/screen_interactive.hpp>
 #include <ftxui/dom/elements.hpp>
+#include <atomic>
 
 #include "TFFoundation.hpp"
 #include "data_model.hpp"
@@ -58,7 +59,7 @@ namespace copy
     private:
         Component m_buttons{};
 
-        bool m_interrupted{false};
+        std::atomic<bool> m_interrupted{false};
         bool m_load_thread_finished{false};
         bool m_load_thread_started{false};
 
@@ -25,12 +25,15 @@
  *
  * ******************************************************************************/
 
+#include <limits>
+#include <fcntl.h>
 #include "TFFoundation.hpp"
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/screen_interactive.hpp>
 #include <ftxui/dom/elements.hpp>
 
 #include "data_model.hpp"
+#include "headless_copy.hpp"
 #include "loading_panel.hpp"
 #include "copy_panel.hpp"
 #include "startup_panel.hpp"
@@ -52,6 +55,47 @@ int main(int argc, const char ** argv)
     parser.addStoreTrueArgument({"-v", "--version"}, "", data_model.tool_name + " Version", false);
     parser.addStoreTrueArgument({"-p", "--fix_paths"}, "", "Automatically correct problematic characters in file paths",
                                 false);
+    parser.addStoreTrueArgument({"-s", "--stream"}, "", "Start copying while the source is still being scanned", false);
+    parser.addStoreTrueArgument({"--io_uring"}, "", "Copy small files in batches through io_uring when available",
+                                false);
+    parser.addStoreTrueArgument({"--sync"}, "", "Skip files whose destination has the same size and modification time",
+                                false);
+    parser.addStoreTrueArgument({"--checksum"}, "",
+                                "Skip files whose destination has the same contents; implies --sync", false);
+    parser.addStoreTrueArgument({"--resume"}, "", "Continue an interrupted copy from its journal", false);
+    parser.addStoreTrueArgument(
+        {"-a", "--preserve"}, "",
+        "Keep times, owners, extended attributes and ACLs, and copy symbolic and hard links as links", false);
+    parser.addStoreTrueArgument({"-H", "--hard_links"}, "", "Recreate hard links as links instead of copying each name",
+                                false);
+    parser.addArgument({"--dedup"}, ArgumentType::String, "",
+                       "Files with the same contents as one copied earlier: link (hard link) or reflink (clone)",
+                       false);
+    parser.addStoreTrueArgument({"--verify"}, "", "Hash files while copying, then read them back and compare", false);
+    parser.addArgument({"--verify_hash"}, ArgumentType::String, "",
+                       "Hash for --verify: xxh3 (default, fast) or sha256 (cryptographic)", false);
+    parser.addStoreTrueArgument({"--headless"}, "", "Copy without the interface and print JSON progress lines",
+                                false);
+    parser.addArgument({"--progress_interval"}, ArgumentType::Int, "",
+                       "Milliseconds between progress lines in headless mode (default 1000)", false);
+    parser.addArgument({"--progress_fd"}, ArgumentType::Int, "",
+                       "File descriptor for progress lines in headless mode (default 1)", false);
+    parser.addArgument({"-j", "--jobs"}, ArgumentType::Int, "", "Number of files to copy concurrently", false);
+    parser.addArgument({"--buffer_size"}, ArgumentType::Int, "",
+                       "Read/write buffer size in KiB (default: tuned while copying)", false);
+    parser.addArgument({"--cache_mode"}, ArgumentType::String, "",
+                       "Page cache use: normal (default), drop_behind (drop copied pages) or direct (O_DIRECT)",
+                       false);
+    parser.addArgument({"--order"}, ArgumentType::String, "",
+                       "File order: auto (default, extent on rotational disks), scan, inode or extent", false);
+    parser.addArgument({"--prefetch"}, ArgumentType::Int, "",
+                       "Number of queued files to read ahead of the copy (default 16, 0 disables)", false);
+    parser.addArgument({"--large_file_threshold"}, ArgumentType::Int, "",
+                       "Size in MiB at which a file is copied by several workers at once (0 disables)", false);
+    parser.addArgument({"--rate_limit"}, ArgumentType::Int, "",
+                       "Most MiB per second to copy (default: no limit, adjustable while copying)", false);
+    parser.addArgument({"--file_rate_limit"}, ArgumentType::Int, "",
+                       "Most files per second to copy (default: no limit)", false);
     parser.addPositionalArgument("source", ArgumentType::String, "Source path", false);
     parser.addPositionalArgument("destination", ArgumentType::String, "Destination path", false);
 
@@ -64,6 +108,159 @@ int main(int argc, const char ** argv)
     parser.getValueForArgument("version", display_version);
 
     parser.getValueForArgument("fix_paths", data_model.fix_problematic_file_paths);
+    parser.getValueForArgument("stream", data_model.stream_copy);
+    parser.getValueForArgument("io_uring", data_model.use_io_uring);
+    parser.getValueForArgument("sync", data_model.sync);
+    parser.getValueForArgument("checksum", data_model.sync_by_content);
+    data_model.sync = data_model.sync || data_model.sync_by_content;
+    parser.getValueForArgument("resume", data_model.resume);
+    parser.getValueForArgument("preserve", data_model.preserve);
+    parser.getValueForArgument("hard_links", data_model.hard_links);
+    data_model.hard_links = data_model.hard_links || data_model.preserve;
+    parser.getValueForArgument("verify", data_model.verify);
+    parser.getValueForArgument("headless", data_model.headless);
+
+    if (parser.hasValueForArgument("jobs"))
+    {
+        int64_t jobs{0};
+        parser.getValueForArgument("jobs", jobs);
+        if (jobs < 1)
+        {
+            std::cout << "--jobs must be at least 1" << std::endl;
+            return -1;
+        }
+        data_model.copy_jobs = static_cast<DataModel::size_type>(jobs);
+    }
+
+    if (parser.hasValueForArgument("large_file_threshold"))
+    {
+        int64_t threshold{0};
+        parser.getValueForArgument("large_file_threshold", threshold);
+        if (threshold < 0)
+        {
+            std::cout << "--large_file_threshold cannot be negative" << std::endl;
+            return -1;
+        }
+        data_model.large_file_threshold = static_cast<DataModel::size_type>(threshold) * 1024 * 1024;
+    }
+
+    if (parser.hasValueForArgument("prefetch"))
+    {
+        int64_t files{0};
+        parser.getValueForArgument("prefetch", files);
+        if (files < 0)
+        {
+            std::cout << "--prefetch cannot be negative" << std::endl;
+            return -1;
+        }
+        data_model.prefetch_files = static_cast<DataModel::size_type>(files);
+    }
+
+    if (parser.hasValueForArgument("rate_limit"))
+    {
+        int64_t limit{0};
+        parser.getValueForArgument("rate_limit", limit);
+        if (limit < 0)
+        {
+            std::cout << "--rate_limit cannot be negative" << std::endl;
+            return -1;
+        }
+        data_model.throttle.set_bytes_per_second(static_cast<DataModel::size_type>(limit) * 1024 * 1024);
+    }
+
+    if (parser.hasValueForArgument("file_rate_limit"))
+    {
+        int64_t limit{0};
+        parser.getValueForArgument("file_rate_limit", limit);
+        if (limit < 0)
+        {
+            std::cout << "--file_rate_limit cannot be negative" << std::endl;
+            return -1;
+        }
+        data_model.throttle.set_files_per_second(static_cast<DataModel::size_type>(limit));
+    }
+
+    if (parser.hasValueForArgument("verify_hash"))
+    {
+        String hash_name{};
+        parser.getValueForArgument("verify_hash", hash_name);
+        if (! ContentHasher::algorithm_named(hash_name.stlStringInUTF8(), data_model.verify_algorithm))
+        {
+            std::cout << "--verify_hash must be xxh3 or sha256" << std::endl;
+            return -1;
+        }
+        data_model.verify = true;
+    }
+
+    if (parser.hasValueForArgument("dedup"))
+    {
+        String mode_name{};
+        parser.getValueForArgument("dedup", mode_name);
+        if (! DuplicateFinder::mode_named(mode_name.stlStringInUTF8(), data_model.dedup))
+        {
+            std::cout << "--dedup must be off, link or reflink" << std::endl;
+            return -1;
+        }
+    }
+
+    if (parser.hasValueForArgument("order"))
+    {
+        String order_name{};
+        parser.getValueForArgument("order", order_name);
+        if (! CopyScheduler::order_named(order_name.stlStringInUTF8(), data_model.copy_order))
+        {
+            std::cout << "--order must be auto, scan, inode or extent" << std::endl;
+            return -1;
+        }
+    }
+
+    if (parser.hasValueForArgument("cache_mode"))
+    {
+        String mode_name{};
+        parser.getValueForArgument("cache_mode", mode_name);
+        if (! FileCopier::cache_mode_named(mode_name.stlStringInUTF8(), data_model.cache_mode))
+        {
+            std::cout << "--cache_mode must be normal, drop_behind or direct" << std::endl;
+            return -1;
+        }
+    }
+
+    if (parser.hasValueForArgument("buffer_size"))
+    {
+        int64_t buffer_size{0};
+        parser.getValueForArgument("buffer_size", buffer_size);
+        if (buffer_size < 4 || buffer_size > 1024 * 1024)
+        {
+            std::cout << "--buffer_size must be between 4 and 1048576 KiB" << std::endl;
+            return -1;
+        }
+        data_model.buffer_size = static_cast<DataModel::size_type>(buffer_size) * 1024;
+    }
+
+    if (parser.hasValueForArgument("progress_interval"))
+    {
+        int64_t interval{0};
+        parser.getValueForArgument("progress_interval", interval);
+        if (interval < 1)
+        {
+            std::cout << "--progress_interval must be at least 1" << std::endl;
+            return -1;
+        }
+        data_model.progress_interval = std::chrono::milliseconds{interval};
+    }
+
+    if (parser.hasValueForArgument("progress_fd"))
+    {
+        int64_t descriptor{0};
+        parser.getValueForArgument("progress_fd", descriptor);
+        if (descriptor < 0 || descriptor > std::numeric_limits<int>::max() ||
+            ::fcntl(static_cast<int>(descriptor), F_GETFD) == -1)
+        {
+            std::cout << "--progress_fd is not an open file descriptor" << std::endl;
+            return -1;
+        }
+        data_model.progress_descriptor = static_cast<int>(descriptor);
+    }
 
     String source_path{};
     if (parser.hasValueForArgument("source"))
@@ -104,6 +301,12 @@ int main(int argc, const char ** argv)
     data_model.source_path = source_path;
     data_model.destination_path = destination_path;
 
+    if (data_model.headless)
+    {
+        HeadlessCopy headless_copy{data_model};
+        return headless_copy.run();
+    }
+
     auto screen = ScreenInteractive::Fullscreen();
     auto startup_component = std::make_shared<StartupPanel>(screen, data_model);
     auto loading_component = std::make_shared<LoadingPanel>(screen, data_model);
@@ -0,0 +1,269 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#    include <sys/xattr.h>
+#endif
+#include "TFFoundation.hpp"
+#include "file_descriptor.hpp"
+#include "metadata_copier.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    namespace
+    {
+        // Missing privileges or support on either side; cp -a does not complain about these either.
+        auto is_quiet_error(int error) -> bool
+        {
+            return error == EPERM || error == ENOTSUP || error == EOPNOTSUPP;
+        }
+
+        void warn(const char * what, const std::string & path, int error)
+        {
+            LOG(LogPriority::Warning, String{"Unable to "} + String{what} + " of " + String{path.c_str()} + ": " +
+                                          String{std::strerror(error)})
+        }
+
+        auto times_of(const struct stat & status) -> std::array<struct timespec, 2>
+        {
+#if defined(__APPLE__)
+            return {status.st_atimespec, status.st_mtimespec};
+#else
+            return {status.st_atim, status.st_mtim};
+#endif
+        }
+
+#if defined(__linux__)
+        // Asking with no buffer returns the size needed.  The list or the value can grow before the
+        // second call, which fails with ERANGE and is tried again.
+        template <typename Read>
+        auto read_all(Read read, std::vector<char> & buffer) -> ssize_t
+        {
+            while (true)
+            {
+                const auto size = read(nullptr, 0);
+                if (size <= 0)
+                {
+                    return size;
+                }
+                buffer.resize(static_cast<size_t>(size));
+                const auto result = read(buffer.data(), buffer.size());
+                if (result >= 0 || errno != ERANGE)
+                {
+                    return result;
+                }
+            }
+        }
+
+        template <typename List, typename Get, typename Set>
+        void copy_extended_attributes(List list, Get get, Set set, const std::string & destination_path)
+        {
+            std::vector<char> names{};
+            const auto names_size = read_all(list, names);
+            if (names_size < 0)
+            {
+                if (! is_quiet_error(errno))
+                {
+                    warn("list the extended attributes", destination_path, errno);
+                }
+                return;
+            }
+
+            std::vector<char> value{};
+            for (size_t offset = 0; offset < static_cast<size_t>(names_size);)
+            {
+                const auto * name = names.data() + offset;
+                offset += std::strlen(name) + 1;
+
+                const auto size = read_all(
+                    [&get, name](void * buffer, size_t length) -> ssize_t {
+                        return get(name, buffer, length);
+                    },
+                    value);
+                if (size < 0)
+                {
+                    // ENODATA: removed since the list was read.
+                    if (errno != ENODATA && ! is_quiet_error(errno))
+                    {
+                        warn("read the extended attributes", destination_path, errno);
+                    }
+                    continue;
+                }
+                if (set(name, value.data(), static_cast<size_t>(size)) != 0 && ! is_quiet_error(errno))
+                {
+                    warn("set the extended attributes", destination_path, errno);
+                }
+            }
+        }
+#endif
+    } // namespace
+
+    void MetadataCopier::apply(int source, int destination, const struct stat & status,
+                               const std::string & destination_path) const
+    {
+        if (m_attributes.ownership && ::fchown(destination, status.st_uid, status.st_gid) != 0)
+        {
+            // Without the privilege to give files away, the group may still be one of ours.
+            if (errno == EPERM)
+            {
+                if (::fchown(destination, static_cast<uid_t>(-1), status.st_gid) != 0)
+                {
+                    warn("set the group", destination_path, errno);
+                }
+            }
+            else
+            {
+                warn("set the owner", destination_path, errno);
+            }
+        }
+
+        if (::fchmod(destination, status.st_mode & 07777) != 0)
+        {
+            warn("set the mode", destination_path, errno);
+        }
+
+#if defined(__linux__)
+        if (m_attributes.extended_attributes)
+        {
+            copy_extended_attributes(
+                [source](char * buffer, size_t size) -> ssize_t {
+                    return ::flistxattr(source, buffer, size);
+                },
+                [source](const char * name, void * buffer, size_t size) -> ssize_t {
+                    return ::fgetxattr(source, name, buffer, size);
+                },
+                [destination](const char * name, const void * value, size_t size) -> int {
+                    return ::fsetxattr(destination, name, value, size, 0);
+                },
+                destination_path);
+        }
+#else
+        (void)source;
+#endif
+
+        if (m_attributes.times)
+        {
+            const auto times = times_of(status);
+            if (::futimens(destination, times.data()) != 0)
+            {
+                warn("set the times", destination_path, errno);
+            }
+        }
+    }
+
+    void MetadataCopier::apply(const std::string & source_path, const std::string & destination_path,
+                               const struct stat & status) const
+    {
+        const auto * destination = destination_path.c_str();
+        if (m_attributes.ownership && ::lchown(destination, status.st_uid, status.st_gid) != 0)
+        {
+            if (errno == EPERM)
+            {
+                if (::lchown(destination, static_cast<uid_t>(-1), status.st_gid) != 0)
+                {
+                    warn("set the group", destination_path, errno);
+                }
+            }
+            else
+            {
+                warn("set the owner", destination_path, errno);
+            }
+        }
+
+        // Linux has no mode for symbolic links.
+        if (! S_ISLNK(status.st_mode) && ::chmod(destination, status.st_mode & 07777) != 0)
+        {
+            warn("set the mode", destination_path, errno);
+        }
+
+#if defined(__linux__)
+        if (m_attributes.extended_attributes)
+        {
+            const auto * source = source_path.c_str();
+            copy_extended_attributes(
+                [source](char * buffer, size_t size) -> ssize_t {
+                    return ::llistxattr(source, buffer, size);
+                },
+                [source](const char * name, void * buffer, size_t size) -> ssize_t {
+                    return ::lgetxattr(source, name, buffer, size);
+                },
+                [destination](const char * name, const void * value, size_t size) -> int {
+                    return ::lsetxattr(destination, name, value, size, 0);
+                },
+                destination_path);
+        }
+#else
+        (void)source_path;
+#endif
+
+        if (m_attributes.times)
+        {
+            const auto times = times_of(status);
+            if (::utimensat(AT_FDCWD, destination, times.data(), AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                warn("set the times", destination_path, errno);
+            }
+        }
+    }
+
+    void MetadataCopier::defer_directory(std::string source_path, std::string destination_path)
+    {
+        m_directories.push_back(DeferredDirectory{std::move(source_path), std::move(destination_path)});
+    }
+
+    void MetadataCopier::apply_to_directories()
+    {
+        // The scan adds a directory before its contents, so going backwards does children before
+        // their parents and a parent turning read-only gets in nobody's way.
+        for (auto directory = m_directories.rbegin(); directory != m_directories.rend(); ++directory)
+        {
+            // A link to a directory only shows up as a directory when the scan follows links, and then
+            // it is the target whose metadata is wanted.
+            const auto flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+            FileDescriptor source{::open(directory->source_path.c_str(), flags)};
+            FileDescriptor destination{::open(directory->destination_path.c_str(), flags | O_NOFOLLOW)};
+            struct stat status
+            {};
+            if (! source.is_valid() || ! destination.is_valid() || ::fstat(source.get(), &status) != 0)
+            {
+                warn("read the metadata", directory->destination_path, errno);
+                continue;
+            }
+            apply(source.get(), destination.get(), status, directory->destination_path);
+        }
+        m_directories.clear();
+    }
+
+} // namespace copy
@@ -0,0 +1,108 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef METADATA_COPIER_HPP
+#define METADATA_COPIER_HPP
+
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+namespace copy
+{
+
+    /**
+     * @brief class that copies the metadata of an item onto its copy.
+     *
+     * The permissions are always copied.  The other attributes are optional: the access and
+     * modification times with nanoseconds, the owner and group, and the extended attributes.  On
+     * Linux, POSIX ACLs are extended attributes in the system namespace, so they come along with the
+     * rest.  The owner goes first because a chown clears the set-user-ID bits.  The ACLs follow the
+     * mode because they override its group bits, and the times go last.
+     *
+     * Files are handled through the descriptors the copy already has open.  Directories get their
+     * metadata in one pass at the end, so copying into them cannot change their times or run into
+     * a read-only mode.  A failure is logged and the copy goes on.  Ownership and extended
+     * attributes that need privileges the process lacks are skipped quietly, the way cp -a does.
+     */
+    class MetadataCopier
+    {
+    public:
+        struct Attributes
+        {
+            bool times{false};
+            bool ownership{false};
+            bool extended_attributes{false};
+        };
+
+        MetadataCopier() = default;
+
+        explicit MetadataCopier(Attributes attributes) : m_attributes{attributes} {}
+
+        [[nodiscard]] auto attributes() const -> const Attributes &
+        {
+            return m_attributes;
+        }
+
+        /**
+         * @brief method to copy the metadata in @e status, and the extended attributes of the open
+         * file @e source, to the open file @e destination.  @e destination_path is only for messages.
+         */
+        void apply(int source, int destination, const struct stat & status, const std::string & destination_path) const;
+
+        /**
+         * @brief method to copy the metadata by path, for items the copy has no descriptor for.  A
+         * symbolic link itself is changed, never its target, and has no mode to set.
+         */
+        void apply(const std::string & source_path, const std::string & destination_path,
+                   const struct stat & status) const;
+
+        /**
+         * @brief method to remember a directory for apply_to_directories().  Not thread safe.
+         */
+        void defer_directory(std::string source_path, std::string destination_path);
+
+        /**
+         * @brief method to copy the metadata of every deferred directory, deepest first, and forget
+         * them.
+         */
+        void apply_to_directories();
+
+    private:
+        struct DeferredDirectory
+        {
+            std::string source_path{};
+            std::string destination_path{};
+        };
+
+        Attributes m_attributes{};
+        std::vector<DeferredDirectory> m_directories{};
+    };
+
+} // namespace copy
+
+#endif // METADATA_COPIER_HPP
@@ -0,0 +1,153 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include "path_builder.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        auto split_last(std::string_view path) -> std::pair<std::string_view, std::string_view>
+        {
+            const auto separator = path.rfind('/');
+            if (separator == std::string_view::npos)
+            {
+                return {std::string_view{}, path};
+            }
+            return {path.substr(0, separator), path.substr(separator + 1)};
+        }
+    } // namespace
+
+    PathBuilder::PathBuilder(std::string source_root, std::string destination_root, bool fix_problematic_paths) :
+        m_source_root{std::move(source_root)}, m_destination_root{std::move(destination_root)},
+        m_fix_problematic_paths{fix_problematic_paths}
+    {}
+
+    void PathBuilder::set_item(std::string_view relative_path)
+    {
+        m_source.assign(m_source_root).append(1, '/').append(relative_path);
+
+        const auto [relative_directory, name] = split_last(relative_path);
+        if (! m_fix_problematic_paths)
+        {
+            m_destination.assign(m_destination_root);
+            if (! relative_directory.empty())
+            {
+                m_destination.append(1, '/').append(relative_directory);
+            }
+            m_directory_length = m_destination.size();
+            m_destination.append(1, '/').append(name);
+            return;
+        }
+
+        m_destination.assign(fixed_directory(relative_directory));
+        m_directory_length = m_destination.size();
+        m_destination.append(1, '/');
+        append_fixed_component(name, m_destination);
+    }
+
+    auto PathBuilder::fixed_directory(std::string_view relative_directory) -> const std::string &
+    {
+        if (auto directory = m_fixed_directories.find(relative_directory); directory != m_fixed_directories.end())
+        {
+            return directory->second;
+        }
+
+        // The scan adds a directory before its contents, so the parent is nearly always known.
+        std::string fixed{};
+        if (relative_directory.empty())
+        {
+            fixed = fixed_path(m_destination_root);
+        }
+        else
+        {
+            const auto [parent, name] = split_last(relative_directory);
+            fixed = fixed_directory(parent);
+            fixed.append(1, '/');
+            append_fixed_component(name, fixed);
+        }
+        return m_fixed_directories.emplace(std::string{relative_directory}, std::move(fixed)).first->second;
+    }
+
+    void PathBuilder::append_fixed_component(std::string_view component, std::string & path)
+    {
+        for (const auto character : component)
+        {
+            switch (character)
+            {
+                case ':':
+                    path.append(1, '_');
+                    break;
+                case '"':
+                    path.append("\\\\\"");
+                    break;
+                case ' ':
+                    path.append("\\ ");
+                    break;
+                default:
+                    path.append(1, character);
+                    break;
+            }
+        }
+        // The escape for a trailing space loses its space.
+        if (! component.empty() && component.back() == ' ')
+        {
+            path.pop_back();
+        }
+    }
+
+    auto PathBuilder::fixed_path(std::string_view path) -> std::string
+    {
+        std::string fixed{};
+        fixed.reserve(path.size());
+        if (path.starts_with('/'))
+        {
+            fixed.append(1, '/');
+        }
+
+        bool first{true};
+        while (! path.empty())
+        {
+            const auto separator = path.find('/');
+            const auto component = path.substr(0, separator);
+            path.remove_prefix(separator == std::string_view::npos ? path.size() : separator + 1);
+            if (component.empty())
+            {
+                continue;
+            }
+            if (! first)
+            {
+                fixed.append(1, '/');
+            }
+            append_fixed_component(component, fixed);
+            first = false;
+        }
+        return fixed;
+    }
+
+} // namespace copy
@@ -0,0 +1,118 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef PATH_BUILDER_HPP
+#define PATH_BUILDER_HPP
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace copy
+{
+
+    /**
+     * @brief class that turns the relative paths in a FileInventory into source and destination
+     * paths.
+     *
+     * Both paths are built in buffers that are reused from one item to the next, so an item costs
+     * no allocations once the buffers have grown.  With problematic path fixing on, each path
+     * component is rewritten in one pass.  The rewritten destination of every directory is
+     * remembered, so a file only pays for its own name.  Not thread safe.
+     */
+    class PathBuilder
+    {
+    public:
+        PathBuilder() = default;
+
+        PathBuilder(std::string source_root, std::string destination_root, bool fix_problematic_paths);
+
+        /**
+         * @brief method to build the paths of the item at @e relative_path.  The results stay valid
+         * until the next call.
+         */
+        void set_item(std::string_view relative_path);
+
+        [[nodiscard]] auto source() const -> const std::string &
+        {
+            return m_source;
+        }
+
+        [[nodiscard]] auto destination() const -> const std::string &
+        {
+            return m_destination;
+        }
+
+        /**
+         * @return the destination of the directory that holds the item.
+         */
+        [[nodiscard]] auto destination_directory() const -> std::string_view
+        {
+            return std::string_view{m_destination}.substr(0, m_directory_length);
+        }
+
+        /**
+         * @brief method to append @e component to @e path with the characters that trouble other
+         * tools fixed: a colon becomes an underscore, and quotes and spaces are escaped with a
+         * backslash.  A trailing space is dropped.
+         */
+        static void append_fixed_component(std::string_view component, std::string & path);
+
+        /**
+         * @brief method to fix every component of @e path.  Empty components are dropped.
+         */
+        [[nodiscard]] static auto fixed_path(std::string_view path) -> std::string;
+
+    private:
+        struct PathHash
+        {
+            using is_transparent = void;
+
+            auto operator()(std::string_view path) const -> size_t
+            {
+                return std::hash<std::string_view>{}(path);
+            }
+        };
+
+        std::string m_source_root{};
+        std::string m_destination_root{};
+        bool m_fix_problematic_paths{false};
+
+        std::string m_source{};
+        std::string m_destination{};
+        std::string::size_type m_directory_length{0};
+
+        // The fixed destination of each directory, by its path relative to the source root.
+        std::unordered_map<std::string, std::string, PathHash, std::equal_to<>> m_fixed_directories{};
+
+        auto fixed_directory(std::string_view relative_directory) -> const std::string &;
+    };
+
+} // namespace copy
+
+#endif // PATH_BUILDER_HPP
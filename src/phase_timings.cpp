@@ -0,0 +1,174 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include "phase_timings.hpp"
+#include "thread_index.hpp"
+
+namespace copy
+{
+
+    PhaseTimings::PhaseTimings(size_type slots) :
+        m_slot_count{slots > 0 ? slots : 1}, m_slots{std::make_unique<Slot[]>(m_slot_count)}
+    {}
+
+    void PhaseTimings::record(Phase phase, clock_type::duration duration)
+    {
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        add(phase, static_cast<size_type>(std::max<int64_t>(nanoseconds, 0)), 1);
+    }
+
+    void PhaseTimings::record_batch(Phase phase, clock_type::duration duration, size_type items)
+    {
+        if (items == 0)
+        {
+            return;
+        }
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        add(phase, static_cast<size_type>(std::max<int64_t>(nanoseconds, 0)) / items, items);
+    }
+
+    void PhaseTimings::add(Phase phase, size_type nanoseconds, size_type items)
+    {
+        auto & histogram = m_slots[current_thread_index() % m_slot_count].phases[static_cast<size_t>(phase)];
+        const auto bucket =
+            nanoseconds > 0 ? std::min<size_t>(static_cast<size_t>(std::bit_width(nanoseconds)), bucket_count) - 1 : 0;
+        histogram.count.fetch_add(items, std::memory_order_relaxed);
+        histogram.total_nanoseconds.fetch_add(nanoseconds * items, std::memory_order_relaxed);
+        histogram.buckets[bucket].fetch_add(items, std::memory_order_relaxed);
+
+        auto max = histogram.max_nanoseconds.load(std::memory_order_relaxed);
+        while (nanoseconds > max &&
+               ! histogram.max_nanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    auto PhaseTimings::summary(Phase phase) const -> Summary
+    {
+        Summary summary{};
+        for (size_type index = 0; index < m_slot_count; index++)
+        {
+            const auto & histogram = m_slots[index].phases[static_cast<size_t>(phase)];
+            summary.count += histogram.count.load(std::memory_order_relaxed);
+            summary.total_nanoseconds += histogram.total_nanoseconds.load(std::memory_order_relaxed);
+            summary.max_nanoseconds =
+                std::max(summary.max_nanoseconds, histogram.max_nanoseconds.load(std::memory_order_relaxed));
+            for (size_t bucket = 0; bucket < bucket_count; bucket++)
+            {
+                summary.buckets[bucket] += histogram.buckets[bucket].load(std::memory_order_relaxed);
+            }
+        }
+        return summary;
+    }
+
+    auto PhaseTimings::Summary::quantile_nanoseconds(double fraction) const -> size_type
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        const auto target = static_cast<size_type>(fraction * static_cast<double>(count));
+        size_type seen{0};
+        for (size_t bucket = 0; bucket < bucket_count; bucket++)
+        {
+            seen += buckets[bucket];
+            if (seen > target)
+            {
+                return std::min(size_type{1} << (bucket + 1), max_nanoseconds);
+            }
+        }
+        return max_nanoseconds;
+    }
+
+    auto PhaseTimings::report() const -> std::string
+    {
+        std::string report{"phase        count       mean     median        p99        max      total\n"};
+        for (size_t index = 0; index < phase_count; index++)
+        {
+            const auto phase = static_cast<Phase>(index);
+            const auto summary = this->summary(phase);
+            char line[160]{};
+            std::snprintf(line, sizeof(line), "%-8s %9llu %10s %10s %10s %10s %10s\n", name_of(phase),
+                          static_cast<unsigned long long>(summary.count),
+                          format_nanoseconds(summary.mean_nanoseconds()).c_str(),
+                          format_nanoseconds(summary.quantile_nanoseconds(0.5)).c_str(),
+                          format_nanoseconds(summary.quantile_nanoseconds(0.99)).c_str(),
+                          format_nanoseconds(summary.max_nanoseconds).c_str(),
+                          format_nanoseconds(summary.total_nanoseconds).c_str());
+            report += line;
+        }
+        return report;
+    }
+
+    auto PhaseTimings::name_of(Phase phase) -> const char *
+    {
+        switch (phase)
+        {
+            case Phase::Mkdir:
+                return "mkdir";
+            case Phase::Stat:
+                return "stat";
+            case Phase::Open:
+                return "open";
+            case Phase::Transfer:
+                return "transfer";
+            case Phase::Chmod:
+                return "chmod";
+            case Phase::Close:
+                return "close";
+        }
+        return "unknown";
+    }
+
+    auto PhaseTimings::format_nanoseconds(size_type nanoseconds) -> std::string
+    {
+        char text[32]{};
+        const auto value = static_cast<double>(nanoseconds);
+        if (nanoseconds < 1'000)
+        {
+            std::snprintf(text, sizeof(text), "%lluns", static_cast<unsigned long long>(nanoseconds));
+        }
+        else if (nanoseconds < 1'000'000)
+        {
+            std::snprintf(text, sizeof(text), "%.1fus", value / 1e3);
+        }
+        else if (nanoseconds < 1'000'000'000)
+        {
+            std::snprintf(text, sizeof(text), "%.1fms", value / 1e6);
+        }
+        else
+        {
+            std::snprintf(text, sizeof(text), "%.2fs", value / 1e9);
+        }
+        return text;
+    }
+
+} // namespace copy
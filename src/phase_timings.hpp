@@ -0,0 +1,169 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef PHASE_TIMINGS_HPP
+#define PHASE_TIMINGS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace copy
+{
+
+    /**
+     * @brief class that keeps a latency histogram for each phase of copying a file.
+     *
+     * Histograms have one bucket per power of two nanoseconds.  Like ProgressCounters, each thread
+     * records into a cache-line-aligned slot picked by its thread index with relaxed atomic adds, so
+     * recording costs two clock reads and a few adds that rarely contend.  Readers merge the slots
+     * into a Summary.
+     */
+    class PhaseTimings
+    {
+    public:
+        using size_type = uint64_t;
+        using clock_type = std::chrono::steady_clock;
+
+        enum class Phase : uint8_t
+        {
+            Mkdir,
+            Stat,
+            Open,
+            Transfer,
+            Chmod,
+            Close
+        };
+
+        static constexpr size_t phase_count{6};
+
+        // Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds; the last bucket also takes anything longer.
+        static constexpr size_t bucket_count{40};
+
+        struct Summary
+        {
+            size_type count{0};
+            size_type total_nanoseconds{0};
+            size_type max_nanoseconds{0};
+            std::array<size_type, bucket_count> buckets{};
+
+            [[nodiscard]] auto mean_nanoseconds() const -> size_type
+            {
+                return count > 0 ? total_nanoseconds / count : 0;
+            }
+
+            /**
+             * @return the upper bound of the bucket that holds the @e fraction quantile, e.g. 0.99.
+             */
+            [[nodiscard]] auto quantile_nanoseconds(double fraction) const -> size_type;
+        };
+
+        /**
+         * @brief class that records the time from its construction to stop() or its destruction.
+         * A null PhaseTimings records nothing.
+         */
+        class Timer
+        {
+        public:
+            Timer(PhaseTimings * timings, Phase phase) :
+                m_timings{timings}, m_phase{phase}, m_start{timings ? clock_type::now() : clock_type::time_point{}}
+            {}
+
+            Timer(const Timer &) = delete;
+
+            Timer & operator=(const Timer &) = delete;
+
+            ~Timer()
+            {
+                stop();
+            }
+
+            void stop()
+            {
+                if (m_timings)
+                {
+                    m_timings->record(m_phase, clock_type::now() - m_start);
+                    m_timings = nullptr;
+                }
+            }
+
+        private:
+            PhaseTimings * m_timings{nullptr};
+            Phase m_phase{Phase::Mkdir};
+            clock_type::time_point m_start{};
+        };
+
+        explicit PhaseTimings(size_type slots = 16);
+
+        void record(Phase phase, clock_type::duration duration);
+
+        /**
+         * @brief method to record a batch of @e items that shared one @e duration, such as an
+         * io_uring round.  Each item is recorded with an equal share.
+         */
+        void record_batch(Phase phase, clock_type::duration duration, size_type items);
+
+        [[nodiscard]] auto summary(Phase phase) const -> Summary;
+
+        /**
+         * @return a table of count, mean, median, 99th percentile, max and total time per phase.
+         */
+        [[nodiscard]] auto report() const -> std::string;
+
+        [[nodiscard]] static auto name_of(Phase phase) -> const char *;
+
+        /**
+         * @return @e nanoseconds as a short human readable duration such as "850ns" or "12.5ms".
+         */
+        [[nodiscard]] static auto format_nanoseconds(size_type nanoseconds) -> std::string;
+
+    private:
+        struct Histogram
+        {
+            std::atomic<size_type> count{0};
+            std::atomic<size_type> total_nanoseconds{0};
+            std::atomic<size_type> max_nanoseconds{0};
+            std::array<std::atomic<size_type>, bucket_count> buckets{};
+        };
+
+        struct alignas(64) Slot
+        {
+            std::array<Histogram, phase_count> phases{};
+        };
+
+        size_type m_slot_count{1};
+        std::unique_ptr<Slot[]> m_slots{};
+
+        void add(Phase phase, size_type nanoseconds, size_type items);
+    };
+
+} // namespace copy
+
+#endif // PHASE_TIMINGS_HPP
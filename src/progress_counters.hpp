@@ -0,0 +1,116 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef PROGRESS_COUNTERS_HPP
+#define PROGRESS_COUNTERS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "thread_index.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that counts copy progress without locks or shared cache lines.
+     *
+     * Each thread adds to its own slot, padded to a cache line, with relaxed atomic adds, so the
+     * copy workers never contend on a counter.  Readers add the slots up whenever they want a total;
+     * the result is a consistent enough snapshot for a progress display.  The slot is picked by
+     * current_thread_index().  CopyEngine numbers its workers from 0, so with at least as many slots
+     * as workers no two workers share one; other threads, which count rarely, may share a worker's.
+     */
+    class ProgressCounters
+    {
+    public:
+        using size_type = uint64_t;
+
+        struct Totals
+        {
+            size_type files_copied{0};
+            size_type bytes_copied{0};
+            size_type files_skipped{0};
+            size_type bytes_skipped{0};
+        };
+
+        explicit ProgressCounters(size_type slots) :
+            m_slot_count{slots > 0 ? slots : 1}, m_slots{std::make_unique<Slot[]>(m_slot_count)}
+        {}
+
+        void add_bytes_copied(size_type bytes)
+        {
+            slot().bytes_copied.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        void add_file_copied()
+        {
+            slot().files_copied.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void add_file_skipped(size_type bytes)
+        {
+            auto & counters = slot();
+            counters.files_skipped.fetch_add(1, std::memory_order_relaxed);
+            counters.bytes_skipped.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] auto totals() const -> Totals
+        {
+            Totals totals{};
+            for (size_type index = 0; index < m_slot_count; index++)
+            {
+                const auto & counters = m_slots[index];
+                totals.files_copied += counters.files_copied.load(std::memory_order_relaxed);
+                totals.bytes_copied += counters.bytes_copied.load(std::memory_order_relaxed);
+                totals.files_skipped += counters.files_skipped.load(std::memory_order_relaxed);
+                totals.bytes_skipped += counters.bytes_skipped.load(std::memory_order_relaxed);
+            }
+            return totals;
+        }
+
+    private:
+        struct alignas(64) Slot
+        {
+            std::atomic<size_type> files_copied{0};
+            std::atomic<size_type> bytes_copied{0};
+            std::atomic<size_type> files_skipped{0};
+            std::atomic<size_type> bytes_skipped{0};
+        };
+
+        size_type m_slot_count{1};
+        std::unique_ptr<Slot[]> m_slots{};
+
+        auto slot() -> Slot &
+        {
+            return m_slots[current_thread_index() % m_slot_count];
+        }
+    };
+
+} // namespace copy
+
+#endif // PROGRESS_COUNTERS_HPP
@@ -0,0 +1,67 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef THREAD_INDEX_HPP
+#define THREAD_INDEX_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace copy
+{
+
+    // The number of the calling thread, assigned in the order threads first ask for it.
+    inline auto thread_index_of_caller() -> uint64_t &
+    {
+        static std::atomic<uint64_t> next_thread_index{0};
+        thread_local uint64_t thread_index{next_thread_index++};
+        return thread_index;
+    }
+
+    /**
+     * @return the number of the calling thread, which per-thread counters pick a slot with by modulo.
+     * Threads are numbered in the order they first call this function, unless a thread pool numbers
+     * its workers itself with set_current_thread_index().
+     */
+    inline auto current_thread_index() -> uint64_t
+    {
+        return thread_index_of_caller();
+    }
+
+    /**
+     * @brief method to number the calling thread @e index.  A pool that numbers its workers from 0
+     * gives each one its own slot in counters with at least as many slots as workers; threads
+     * numbered in order of first use may still share a slot with a worker.
+     */
+    inline void set_current_thread_index(uint64_t index)
+    {
+        thread_index_of_caller() = index;
+    }
+
+} // namespace copy
+
+#endif // THREAD_INDEX_HPP
@@ -0,0 +1,135 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <algorithm>
+#include "throttle.hpp"
+
+namespace copy
+{
+
+    namespace
+    {
+        // A bucket holds this many seconds' worth of tokens, which is the burst a worker gets after
+        // standing still.
+        constexpr double burst_seconds{0.5};
+
+        // Waiting workers look at the interrupter at least this often.
+        constexpr auto longest_sleep = std::chrono::milliseconds(100);
+    } // namespace
+
+    void Throttle::set_bytes_per_second(size_type limit)
+    {
+        set_limit(m_bytes, limit);
+    }
+
+    void Throttle::set_files_per_second(size_type limit)
+    {
+        set_limit(m_files, limit);
+    }
+
+    void Throttle::set_limit(Bucket & bucket, size_type limit)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (bucket.limit.load(std::memory_order_relaxed) == 0)
+            {
+                // Starting to limit; there is no history to charge for.
+                bucket.tokens = 0;
+                bucket.filled = clock_type::now();
+            }
+            bucket.limit.store(limit, std::memory_order_relaxed);
+        }
+        m_limits_changed.notify_all();
+    }
+
+    void Throttle::wait(size_type bytes, size_type files, const interrupter_type & interrupted)
+    {
+        if (! is_limited())
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto now = clock_type::now();
+        refill(m_bytes, now);
+        refill(m_files, now);
+        if (m_bytes.limit.load(std::memory_order_relaxed) > 0)
+        {
+            m_bytes.tokens -= static_cast<double>(bytes);
+        }
+        if (m_files.limit.load(std::memory_order_relaxed) > 0)
+        {
+            m_files.tokens -= static_cast<double>(files);
+        }
+
+        while (! (interrupted && interrupted()))
+        {
+            const auto current = clock_type::now();
+            const auto seconds = std::max(refill(m_bytes, current), refill(m_files, current));
+            if (seconds <= 0)
+            {
+                return;
+            }
+            const auto sleep = std::min<clock_type::duration>(
+                std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(seconds)),
+                longest_sleep);
+            m_limits_changed.wait_for(lock, sleep);
+        }
+    }
+
+    auto Throttle::refill(Bucket & bucket, clock_type::time_point now) -> double
+    {
+        const auto limit = static_cast<double>(bucket.limit.load(std::memory_order_relaxed));
+        if (limit <= 0)
+        {
+            bucket.tokens = 0;
+            return 0;
+        }
+
+        const auto elapsed = std::chrono::duration<double>(now - bucket.filled).count();
+        bucket.tokens = std::min(bucket.tokens + elapsed * limit, limit * burst_seconds);
+        bucket.filled = now;
+        return bucket.tokens < 0 ? -bucket.tokens / limit : 0;
+    }
+
+    auto Throttle::estimate_seconds(size_type bytes, size_type files, double measured_rate) const -> double
+    {
+        auto rate = measured_rate;
+        if (const auto limit = static_cast<double>(bytes_per_second()); limit > 0 && (rate <= 0 || limit < rate))
+        {
+            rate = limit;
+        }
+
+        auto seconds = rate > 0 ? static_cast<double>(bytes) / rate : -1.0;
+        if (const auto limit = static_cast<double>(files_per_second()); limit > 0)
+        {
+            seconds = std::max(seconds, static_cast<double>(files) / limit);
+        }
+        return seconds;
+    }
+
+} // namespace copy
@@ -0,0 +1,116 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef THROTTLE_HPP
+#define THROTTLE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace copy
+{
+
+    /**
+     * @brief class that limits the copy to a number of bytes and files per second.
+     *
+     * Each limit is a token bucket that fills at the limit's rate and holds half a second's worth.
+     * A worker takes what it just copied from the bucket and may leave it in debt, then waits until
+     * the debt is paid off.  A chunk larger than the bucket therefore still goes through, and the
+     * average comes out right.  The limits can change while workers wait; zero means no limit, and
+     * with no limit wait() returns without locking.
+     */
+    class Throttle
+    {
+    public:
+        using size_type = uint64_t;
+        using interrupter_type = std::function<bool()>;
+
+        Throttle() = default;
+
+        Throttle(const Throttle &) = delete;
+
+        Throttle & operator=(const Throttle &) = delete;
+
+        void set_bytes_per_second(size_type limit);
+
+        void set_files_per_second(size_type limit);
+
+        [[nodiscard]] auto bytes_per_second() const -> size_type
+        {
+            return m_bytes.limit.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] auto files_per_second() const -> size_type
+        {
+            return m_files.limit.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] auto is_limited() const -> bool
+        {
+            return bytes_per_second() > 0 || files_per_second() > 0;
+        }
+
+        /**
+         * @brief method to account for @e bytes and @e files and wait until the limits allow more.
+         * Returns early once @e interrupted returns true.
+         */
+        void wait(size_type bytes, size_type files, const interrupter_type & interrupted);
+
+        /**
+         * @return the seconds left to copy @e bytes in @e files at @e measured_rate bytes per second,
+         * or at the limits where those are lower.  Negative if there is no rate to go by.
+         */
+        [[nodiscard]] auto estimate_seconds(size_type bytes, size_type files, double measured_rate) const -> double;
+
+    private:
+        using clock_type = std::chrono::steady_clock;
+
+        struct Bucket
+        {
+            std::atomic<size_type> limit{0};
+            double tokens{0};
+            clock_type::time_point filled{};
+        };
+
+        mutable std::mutex m_mutex{};
+        std::condition_variable m_limits_changed{};
+        Bucket m_bytes{};
+        Bucket m_files{};
+
+        void set_limit(Bucket & bucket, size_type limit);
+
+        // Seconds until the bucket is out of debt; zero if it is not in debt.
+        static auto refill(Bucket & bucket, clock_type::time_point now) -> double;
+    };
+
+} // namespace copy
+
+#endif // THROTTLE_HPP
@@ -0,0 +1,358 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#    include <sys/syscall.h>
+#endif
+#include "TFFoundation.hpp"
+#include "tree_scanner.hpp"
+
+using namespace TF::Foundation;
+
+namespace copy
+{
+
+    struct TreeScanner::Directory
+    {
+        explicit Directory(int fd) : descriptor{fd} {}
+
+        Directory(const Directory &) = delete;
+
+        Directory & operator=(const Directory &) = delete;
+
+        ~Directory()
+        {
+            ::close(descriptor);
+        }
+
+        int descriptor{-1};
+    };
+
+    namespace
+    {
+#if defined(__linux__)
+        // The kernel's struct linux_dirent64; glibc only exposes it through getdents64() in newer releases.
+        struct linux_dirent64
+        {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[1];
+        };
+
+        constexpr size_t directory_buffer_size{64 * 1024};
+#endif
+
+        // A directory that keeps failing to open for lack of descriptors waits a millisecond more
+        // before each attempt, about 1.3 seconds in all, before the scan gives up on it.
+        constexpr TreeScanner::size_type reopen_attempts{50};
+
+        auto is_dot_or_dot_dot(const char * name) -> bool
+        {
+            return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+        }
+
+        auto join(const std::string & directory, const char * name) -> std::string
+        {
+            if (directory.empty())
+            {
+                return name;
+            }
+            std::string path{};
+            path.reserve(directory.size() + 1 + std::strlen(name));
+            path.append(directory).append(1, '/').append(name);
+            return path;
+        }
+    } // namespace
+
+    TreeScanner::TreeScanner(FileInventory & inventory, size_type threads) :
+        m_inventory{inventory}, m_thread_count{threads > 0 ? threads : 1}
+    {
+        for (size_type i = 0; i < m_thread_count; i++)
+        {
+            m_queues.emplace_back(std::make_unique<WorkQueue>());
+        }
+    }
+
+    auto TreeScanner::scan(const std::string & root) -> bool
+    {
+        m_failed = false;
+        m_root = root;
+        push_item(0, WorkItem{nullptr, root, std::string{}});
+
+        std::vector<std::thread> threads{};
+        for (size_type worker = 0; worker < m_thread_count; worker++)
+        {
+            threads.emplace_back([this, worker] {
+                worker_loop(worker);
+            });
+        }
+
+        for (auto & thread : threads)
+        {
+            thread.join();
+        }
+
+        return ! m_failed && ! interrupted();
+    }
+
+    void TreeScanner::worker_loop(size_type worker)
+    {
+        WorkItem item{};
+        while (! interrupted())
+        {
+            if (next_item(worker, item))
+            {
+                scan_directory(worker, item);
+                item = WorkItem{};
+                // Children were pushed before this decrement, so the count only reaches zero when the
+                // whole tree is done.
+                m_pending--;
+                continue;
+            }
+
+            if (m_pending == 0)
+            {
+                return;
+            }
+
+            // Another thread is still reading a directory that may produce more work.
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    auto TreeScanner::next_item(size_type worker, WorkItem & item) -> bool
+    {
+        {
+            auto & own_queue = *m_queues[worker];
+            std::lock_guard<std::mutex> lock(own_queue.mutex);
+            if (! own_queue.items.empty())
+            {
+                // Newest first from our own queue keeps the open directory set small.
+                item = std::move(own_queue.items.back());
+                own_queue.items.pop_back();
+                return true;
+            }
+        }
+
+        for (size_type offset = 1; offset < m_thread_count; offset++)
+        {
+            auto & victim_queue = *m_queues[(worker + offset) % m_thread_count];
+            std::lock_guard<std::mutex> lock(victim_queue.mutex);
+            if (! victim_queue.items.empty())
+            {
+                // Oldest first when stealing; those items tend to be the largest subtrees.
+                item = std::move(victim_queue.items.front());
+                victim_queue.items.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void TreeScanner::push_item(size_type worker, WorkItem item)
+    {
+        m_pending++;
+        auto & queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.items.emplace_back(std::move(item));
+    }
+
+    void TreeScanner::retry_item(size_type worker, WorkItem item)
+    {
+        m_pending++;
+        auto & queue = *m_queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.items.emplace_front(std::move(item));
+    }
+
+    void TreeScanner::scan_directory(size_type worker, const WorkItem & item)
+    {
+        if (item.attempts > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(item.attempts));
+        }
+
+        // The root may be a link to a directory, as it could be for the FileManager walk; links below
+        // it are never descended into.
+        const auto is_root = item.relative_path.empty();
+        const auto parent_descriptor = item.parent ? item.parent->descriptor : AT_FDCWD;
+        const auto descriptor = ::openat(parent_descriptor, item.name.c_str(),
+                                         O_RDONLY | O_DIRECTORY | O_CLOEXEC | (is_root ? 0 : O_NOFOLLOW));
+        const auto & path = is_root ? item.name : item.relative_path;
+        if (descriptor < 0)
+        {
+            const auto error = errno;
+            if ((error == EMFILE || error == ENFILE) && ! is_root && item.attempts < reopen_attempts)
+            {
+                // Release the parent, which may be the descriptor everyone is short of, and come back
+                // once other subtrees have finished and closed theirs.
+                retry_item(worker, WorkItem{nullptr, join(m_root, item.relative_path.c_str()), item.relative_path,
+                                            item.attempts + 1});
+                return;
+            }
+            report_failure("open directory", path, error);
+            return;
+        }
+        auto directory = std::make_shared<Directory>(descriptor);
+
+        FileInventory::Batch batch{};
+        std::vector<std::string> subdirectories{};
+
+        auto add_entry = [&](const char * name, bool might_be_link, bool known_not_directory) {
+            struct stat status
+            {};
+            PhaseTimings::Timer timer{m_timings, PhaseTimings::Phase::Stat};
+            auto is_link = might_be_link;
+            if ((! might_be_link || ! m_follow_links) &&
+                ::fstatat(descriptor, name, &status, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                const auto error = errno;
+                report_failure("stat", join(item.relative_path, name), error);
+                return;
+            }
+            if (! might_be_link && S_ISLNK(status.st_mode))
+            {
+                is_link = true;
+            }
+            if (is_link && m_follow_links && ::fstatat(descriptor, name, &status, 0) != 0)
+            {
+                // A dangling link is skipped, as the FileManager walk did; anything else is an error.
+                const auto error = errno;
+                if (error != ENOENT)
+                {
+                    report_failure("stat", join(item.relative_path, name), error);
+                }
+                return;
+            }
+
+            timer.stop();
+
+            auto relative_path = join(item.relative_path, name);
+            batch.add(relative_path, status);
+            if (! is_link && ! known_not_directory && S_ISDIR(status.st_mode))
+            {
+                subdirectories.emplace_back(std::move(relative_path));
+            }
+        };
+
+#if defined(__linux__)
+        std::vector<char> buffer(directory_buffer_size);
+        while (! interrupted())
+        {
+            const auto bytes_read = ::syscall(SYS_getdents64, descriptor, buffer.data(), buffer.size());
+            if (bytes_read < 0)
+            {
+                report_failure("read directory", path, errno);
+                break;
+            }
+            if (bytes_read == 0)
+            {
+                break;
+            }
+
+            for (long offset = 0; offset < bytes_read;)
+            {
+                const auto * entry = reinterpret_cast<const linux_dirent64 *>(buffer.data() + offset);
+                offset += entry->d_reclen;
+
+                if (is_dot_or_dot_dot(entry->d_name))
+                {
+                    continue;
+                }
+
+                const auto type = entry->d_type;
+                add_entry(entry->d_name, type == DT_LNK, type != DT_DIR && type != DT_UNKNOWN);
+            }
+        }
+#else
+        const auto duplicate = ::dup(descriptor);
+        if (auto * stream = ::fdopendir(duplicate))
+        {
+            // readdir() returns nullptr at the end and on errors alike; only an error sets errno.
+            errno = 0;
+            while (auto * entry = ::readdir(stream))
+            {
+                if (! is_dot_or_dot_dot(entry->d_name))
+                {
+                    const auto type = entry->d_type;
+                    add_entry(entry->d_name, type == DT_LNK, type != DT_DIR && type != DT_UNKNOWN);
+                }
+                errno = 0;
+            }
+            if (errno != 0)
+            {
+                report_failure("read directory", path, errno);
+            }
+            ::closedir(stream);
+        }
+        else
+        {
+            report_failure("read directory", path, errno);
+            if (duplicate >= 0)
+            {
+                ::close(duplicate);
+            }
+        }
+#endif
+
+        if (m_entry_callback)
+        {
+            for (const auto & entry : batch.entries())
+            {
+                m_entry_callback(entry);
+            }
+        }
+
+        // Directories enter the inventory before any work item for their contents exists.
+        m_inventory.add(batch);
+
+        for (auto & subdirectory : subdirectories)
+        {
+            const auto name_offset = subdirectory.rfind('/');
+            auto name = name_offset == std::string::npos ? subdirectory : subdirectory.substr(name_offset + 1);
+            push_item(worker, WorkItem{directory, std::move(name), std::move(subdirectory)});
+        }
+    }
+
+    void TreeScanner::report_failure(const char * action, const std::string & path, int error)
+    {
+        m_failed = true;
+        LOG(LogPriority::Critical,
+            "Unable to " + String{action} + " " + String{path.c_str()} + ": " + String{std::strerror(error)})
+    }
+
+} // namespace copy
@@ -0,0 +1,161 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef TREE_SCANNER_HPP
+#define TREE_SCANNER_HPP
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "file_inventory.hpp"
+#include "phase_timings.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that scans a directory tree on several threads and fills a FileInventory.
+     *
+     * Every thread owns a queue of directories to read and steals from the other queues when its own
+     * runs dry.  Directories stay open while their children are pending, so children are opened and
+     * stat'ed relative to their parent with openat(2) and fstatat(2) instead of by full path.  On
+     * Linux directories are read with getdents64(2).  Every entry still takes one fstatat(2), since
+     * the inventory needs its size, times and mode; d_type only spares a followed link its lstat.
+     *
+     * Pending directories hold their ancestors open, so a deep tree can run out of descriptors.  A
+     * directory that fails to open with EMFILE or ENFILE lets go of its parent and is retried later
+     * by full path.  Any entry that cannot be opened, read or stat'ed is logged and fails the scan,
+     * which still carries on so the rest of the tree is recorded.
+     *
+     * Symbolic links are never descended into.  By default they are followed for the entry itself,
+     * which matches the FileManager walk the scanner replaces; set_follow_links(false) records the
+     * links themselves instead.
+     */
+    class TreeScanner
+    {
+    public:
+        using size_type = uint64_t;
+        using entry_callback_type = std::function<void(const FileInventory::Entry & entry)>;
+        using interrupter_type = std::function<bool()>;
+
+        TreeScanner(FileInventory & inventory, size_type threads);
+
+        /**
+         * @brief method to set a callback that sees every entry added to the inventory.  The callback
+         * runs on the scanning threads.
+         */
+        void set_entry_callback(entry_callback_type callback)
+        {
+            m_entry_callback = std::move(callback);
+        }
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to record how long each phase takes in @e timings, which must outlive this
+         * object.
+         */
+        void set_timings(PhaseTimings * timings)
+        {
+            m_timings = timings;
+        }
+
+        /**
+         * @brief method to record symbolic links as links, with their own lstat(2), instead of as the
+         * items they point to.  Dangling links are then recorded too.
+         */
+        void set_follow_links(bool follow)
+        {
+            m_follow_links = follow;
+        }
+
+        /**
+         * @brief method to scan the tree below @e root.  Blocks until the scan finishes.  The root
+         * itself is not added to the inventory.
+         * @return false if any directory or entry could not be read, or the scan was interrupted.
+         */
+        auto scan(const std::string & root) -> bool;
+
+    private:
+        struct Directory;
+
+        struct WorkItem
+        {
+            // Without a parent, name is the full path: the root, or a directory being reopened.
+            std::shared_ptr<Directory> parent{};
+            std::string name{};
+            std::string relative_path{};
+            size_type attempts{0};
+        };
+
+        struct alignas(64) WorkQueue
+        {
+            std::mutex mutex{};
+            std::deque<WorkItem> items{};
+        };
+
+        FileInventory & m_inventory;
+        size_type m_thread_count{1};
+        std::vector<std::unique_ptr<WorkQueue>> m_queues{};
+        std::atomic<size_type> m_pending{0};
+        std::atomic<bool> m_failed{false};
+        std::string m_root{};
+
+        entry_callback_type m_entry_callback{};
+        interrupter_type m_interrupter{};
+        PhaseTimings * m_timings{nullptr};
+        bool m_follow_links{true};
+
+        void worker_loop(size_type worker);
+
+        auto next_item(size_type worker, WorkItem & item) -> bool;
+
+        void push_item(size_type worker, WorkItem item);
+
+        // Queues @e item behind the rest of the worker's queue, so other work goes first.
+        void retry_item(size_type worker, WorkItem item);
+
+        void scan_directory(size_type worker, const WorkItem & item);
+
+        void report_failure(const char * action, const std::string & path, int error);
+
+        [[nodiscard]] auto interrupted() const -> bool
+        {
+            return m_interrupter && m_interrupter();
+        }
+    };
+
+} // namespace copy
+
+#endif // TREE_SCANNER_HPP
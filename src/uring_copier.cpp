@@ -0,0 +1,549 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include "uring_copier.hpp"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#    define COPY_HAVE_IO_URING 1
+#    include <atomic>
+#    include <fcntl.h>
+#    include <linux/io_uring.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <sys/uio.h>
+#    include <unistd.h>
+#endif
+
+namespace copy
+{
+
+#if defined(COPY_HAVE_IO_URING)
+
+    struct UringCopier::Ring
+    {
+        int descriptor{-1};
+        io_uring_params parameters{};
+
+        void * submission_map{MAP_FAILED};
+        size_t submission_map_size{0};
+        void * completion_map{MAP_FAILED};
+        size_t completion_map_size{0};
+        io_uring_sqe * entries{nullptr};
+        size_t entries_size{0};
+
+        unsigned * submission_head{nullptr};
+        unsigned * submission_tail{nullptr};
+        unsigned * submission_mask{nullptr};
+        unsigned * submission_array{nullptr};
+        unsigned * completion_head{nullptr};
+        unsigned * completion_tail{nullptr};
+        unsigned * completion_mask{nullptr};
+        io_uring_cqe * completions{nullptr};
+
+        unsigned local_tail{0};
+
+        Ring() = default;
+
+        Ring(const Ring &) = delete;
+
+        Ring & operator=(const Ring &) = delete;
+
+        ~Ring()
+        {
+            if (entries != nullptr)
+            {
+                ::munmap(entries, entries_size);
+            }
+            if (completion_map != MAP_FAILED && completion_map != submission_map)
+            {
+                ::munmap(completion_map, completion_map_size);
+            }
+            if (submission_map != MAP_FAILED)
+            {
+                ::munmap(submission_map, submission_map_size);
+            }
+            if (descriptor >= 0)
+            {
+                ::close(descriptor);
+            }
+        }
+
+        auto setup(unsigned entry_count) -> bool
+        {
+            descriptor = static_cast<int>(::syscall(__NR_io_uring_setup, entry_count, &parameters));
+            if (descriptor < 0)
+            {
+                return false;
+            }
+
+            submission_map_size = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+            completion_map_size = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+            const auto single_map = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_map)
+            {
+                submission_map_size = std::max(submission_map_size, completion_map_size);
+            }
+
+            submission_map = ::mmap(nullptr, submission_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    descriptor, IORING_OFF_SQ_RING);
+            if (submission_map == MAP_FAILED)
+            {
+                return false;
+            }
+
+            completion_map = single_map ? submission_map
+                                        : ::mmap(nullptr, completion_map_size, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_POPULATE, descriptor, IORING_OFF_CQ_RING);
+            if (completion_map == MAP_FAILED)
+            {
+                return false;
+            }
+
+            entries_size = parameters.sq_entries * sizeof(io_uring_sqe);
+            auto * entries_map = ::mmap(nullptr, entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                        descriptor, IORING_OFF_SQES);
+            if (entries_map == MAP_FAILED)
+            {
+                return false;
+            }
+            entries = static_cast<io_uring_sqe *>(entries_map);
+
+            auto * submission_base = static_cast<char *>(submission_map);
+            submission_head = reinterpret_cast<unsigned *>(submission_base + parameters.sq_off.head);
+            submission_tail = reinterpret_cast<unsigned *>(submission_base + parameters.sq_off.tail);
+            submission_mask = reinterpret_cast<unsigned *>(submission_base + parameters.sq_off.ring_mask);
+            submission_array = reinterpret_cast<unsigned *>(submission_base + parameters.sq_off.array);
+
+            auto * completion_base = static_cast<char *>(completion_map);
+            completion_head = reinterpret_cast<unsigned *>(completion_base + parameters.cq_off.head);
+            completion_tail = reinterpret_cast<unsigned *>(completion_base + parameters.cq_off.tail);
+            completion_mask = reinterpret_cast<unsigned *>(completion_base + parameters.cq_off.ring_mask);
+            completions = reinterpret_cast<io_uring_cqe *>(completion_base + parameters.cq_off.cqes);
+
+            local_tail = std::atomic_ref<unsigned>(*submission_tail).load(std::memory_order_acquire);
+            return true;
+        }
+
+        auto supports(std::initializer_list<unsigned> opcodes) const -> bool
+        {
+            constexpr size_t probe_operations{256};
+            std::vector<char> storage(sizeof(io_uring_probe) + probe_operations * sizeof(io_uring_probe_op));
+            auto * probe = reinterpret_cast<io_uring_probe *>(storage.data());
+            if (::syscall(__NR_io_uring_register, descriptor, IORING_REGISTER_PROBE, probe, probe_operations) < 0)
+            {
+                return false;
+            }
+
+            for (auto opcode : opcodes)
+            {
+                if (opcode > probe->last_op || (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        auto next_entry() -> io_uring_sqe *
+        {
+            const auto head = std::atomic_ref<unsigned>(*submission_head).load(std::memory_order_acquire);
+            if (local_tail - head >= parameters.sq_entries)
+            {
+                return nullptr;
+            }
+
+            const auto index = local_tail & *submission_mask;
+            auto * entry = &entries[index];
+            std::memset(entry, 0, sizeof(*entry));
+            submission_array[index] = index;
+            local_tail++;
+            return entry;
+        }
+
+        /**
+         * @brief submit everything queued with next_entry() without waiting for it to complete.
+         * @return false if the ring itself failed.
+         */
+        auto submit() -> bool
+        {
+            std::atomic_ref<unsigned>(*submission_tail).store(local_tail, std::memory_order_release);
+            const auto head = std::atomic_ref<unsigned>(*submission_head).load(std::memory_order_acquire);
+            const auto result = ::syscall(__NR_io_uring_enter, descriptor, local_tail - head, 0, 0, nullptr, 0);
+            return result >= 0 || errno == EINTR || errno == EAGAIN || errno == EBUSY;
+        }
+
+        /**
+         * @brief submit everything queued with next_entry() and hand each completion to @e handler.
+         * @return false if the ring itself failed.
+         */
+        template<typename Handler>
+        auto submit_and_wait(unsigned count, Handler && handler) -> bool
+        {
+            std::atomic_ref<unsigned>(*submission_tail).store(local_tail, std::memory_order_release);
+
+            unsigned completed{0};
+            while (completed < count)
+            {
+                const auto head = std::atomic_ref<unsigned>(*submission_head).load(std::memory_order_acquire);
+                const auto to_submit = local_tail - head;
+                const auto result = ::syscall(__NR_io_uring_enter, descriptor, to_submit, count - completed,
+                                              IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                {
+                    return false;
+                }
+
+                auto completion = std::atomic_ref<unsigned>(*completion_head).load(std::memory_order_relaxed);
+                const auto tail = std::atomic_ref<unsigned>(*completion_tail).load(std::memory_order_acquire);
+                for (; completion != tail; completion++)
+                {
+                    const auto & entry = completions[completion & *completion_mask];
+                    handler(entry.user_data, entry.res);
+                    completed++;
+                }
+                std::atomic_ref<unsigned>(*completion_head).store(completion, std::memory_order_release);
+            }
+            return true;
+        }
+    };
+
+    namespace
+    {
+        constexpr size_t buffer_alignment{4096};
+
+        // user_data layout: request index in the upper bits, which descriptor in the lowest bit.
+        constexpr uint64_t source_tag{0};
+        constexpr uint64_t destination_tag{1};
+
+        auto tag(size_t request, uint64_t which) -> uint64_t
+        {
+            return (static_cast<uint64_t>(request) << 1) | which;
+        }
+
+        auto allocate_buffers(size_t size) -> char *
+        {
+            const auto rounded = (size + buffer_alignment - 1) / buffer_alignment * buffer_alignment;
+            return static_cast<char *>(std::aligned_alloc(buffer_alignment, rounded));
+        }
+    } // namespace
+
+    UringCopier::UringCopier(size_type batch_size, size_type buffer_size) :
+        m_batch_size{batch_size}, m_buffer_size{(buffer_size + buffer_alignment - 1) / buffer_alignment *
+                                                buffer_alignment},
+        m_buffers{nullptr, std::free}
+    {
+        auto ring = std::make_unique<Ring>();
+        // Two submissions per file in the open and close rounds.
+        if (m_batch_size == 0 || ! ring->setup(static_cast<unsigned>(m_batch_size * 2)) ||
+            ! ring->supports({IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_WRITE}))
+        {
+            return;
+        }
+
+        m_buffers.reset(allocate_buffers(m_batch_size * m_buffer_size));
+        if (! m_buffers)
+        {
+            return;
+        }
+
+        // Registered buffers save the kernel a page pin per I/O.  They count against RLIMIT_MEMLOCK, so
+        // fall back to plain reads and writes when registration is refused.
+        std::vector<iovec> vectors(m_batch_size);
+        for (size_type i = 0; i < m_batch_size; i++)
+        {
+            vectors[i].iov_base = buffer(i);
+            vectors[i].iov_len = m_buffer_size;
+        }
+        m_fixed_buffers = ::syscall(__NR_io_uring_register, ring->descriptor, IORING_REGISTER_BUFFERS, vectors.data(),
+                                    static_cast<unsigned>(vectors.size())) == 0;
+
+        m_ring = std::move(ring);
+    }
+
+    UringCopier::~UringCopier() = default;
+
+    void UringCopier::copy(const std::vector<Request> & requests, std::vector<int> & results)
+    {
+        const auto count = std::min<size_t>(requests.size(), m_batch_size);
+        results.assign(requests.size(), ECANCELED);
+        if (m_hasher)
+        {
+            m_digests.assign(requests.size(), ContentHasher::Digest{});
+        }
+        if (! m_ring || count == 0)
+        {
+            return;
+        }
+
+        auto & ring = *m_ring;
+        std::vector<int> sources(count, -1);
+        std::vector<int> destinations(count, -1);
+        std::vector<size_type> lengths(count, 0);
+
+        auto fail = [&results](size_t request, int error) {
+            if (results[request] == 0)
+            {
+                results[request] = error;
+            }
+        };
+
+        for (size_t i = 0; i < count; i++)
+        {
+            results[i] = 0;
+        }
+
+        auto round_start = PhaseTimings::clock_type::now();
+        auto record_round = [this, &round_start, count](PhaseTimings::Phase phase) {
+            if (m_timings)
+            {
+                const auto now = PhaseTimings::clock_type::now();
+                m_timings->record_batch(phase, now - round_start, count);
+                round_start = now;
+            }
+        };
+
+        // Round one: open every source and destination.
+        unsigned submitted{0};
+        for (size_t i = 0; i < count; i++)
+        {
+            auto * source = ring.next_entry();
+            source->opcode = IORING_OP_OPENAT;
+            source->fd = AT_FDCWD;
+            source->addr = reinterpret_cast<uint64_t>(requests[i].source_path.c_str());
+            source->open_flags = O_RDONLY | O_CLOEXEC;
+            source->user_data = tag(i, source_tag);
+
+            auto * destination = ring.next_entry();
+            destination->opcode = IORING_OP_OPENAT;
+            destination->fd = AT_FDCWD;
+            destination->addr = reinterpret_cast<uint64_t>(requests[i].destination_path.c_str());
+            destination->len = requests[i].mode & 07777;
+            destination->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+            destination->user_data = tag(i, destination_tag);
+            submitted += 2;
+        }
+
+        auto ring_ok = ring.submit_and_wait(submitted, [&](uint64_t user_data, int result) {
+            const auto request = static_cast<size_t>(user_data >> 1);
+            if (result < 0)
+            {
+                fail(request, -result);
+                return;
+            }
+            ((user_data & 1) == destination_tag ? destinations : sources)[request] = result;
+        });
+        record_round(PhaseTimings::Phase::Open);
+
+        // Round two: read each file into its buffer.
+        submitted = 0;
+        for (size_t i = 0; ring_ok && i < count && ! interrupted(); i++)
+        {
+            if (results[i] != 0)
+            {
+                continue;
+            }
+            auto * read = ring.next_entry();
+            read->opcode = m_fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+            read->fd = sources[i];
+            read->addr = reinterpret_cast<uint64_t>(buffer(i));
+            read->len = static_cast<uint32_t>(m_buffer_size);
+            read->off = 0;
+            read->buf_index = static_cast<uint16_t>(i);
+            read->user_data = tag(i, source_tag);
+            submitted++;
+        }
+
+        ring_ok = ring_ok && ring.submit_and_wait(submitted, [&](uint64_t user_data, int result) {
+            const auto request = static_cast<size_t>(user_data >> 1);
+            if (result < 0)
+            {
+                fail(request, -result);
+            }
+            else if (static_cast<size_type>(result) >= m_buffer_size)
+            {
+                // The file may continue past the buffer; let the caller copy it another way.
+                fail(request, file_too_large);
+            }
+            else
+            {
+                lengths[request] = static_cast<size_type>(result);
+            }
+        });
+
+        // Round three: write each buffer out.
+        submitted = 0;
+        for (size_t i = 0; ring_ok && i < count && ! interrupted(); i++)
+        {
+            if (results[i] != 0 || lengths[i] == 0)
+            {
+                continue;
+            }
+            auto * write = ring.next_entry();
+            write->opcode = m_fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+            write->fd = destinations[i];
+            write->addr = reinterpret_cast<uint64_t>(buffer(i));
+            write->len = static_cast<uint32_t>(lengths[i]);
+            write->off = 0;
+            write->buf_index = static_cast<uint16_t>(i);
+            write->user_data = tag(i, destination_tag);
+            submitted++;
+        }
+
+        if (m_hasher && ring_ok)
+        {
+            // Start the writes first; the buffers are only read from here on, so hash them meanwhile.
+            ring_ok = ring.submit();
+            for (size_t i = 0; ring_ok && i < count; i++)
+            {
+                if (results[i] == 0)
+                {
+                    m_hasher->reset();
+                    m_hasher->update(buffer(i), lengths[i]);
+                    m_digests[i] = m_hasher->digest();
+                }
+            }
+        }
+
+        ring_ok = ring_ok && ring.submit_and_wait(submitted, [&](uint64_t user_data, int result) {
+            const auto request = static_cast<size_t>(user_data >> 1);
+            if (result < 0)
+            {
+                fail(request, -result);
+                return;
+            }
+
+            // Short writes to regular files are rare; finish them synchronously.
+            auto written = static_cast<size_type>(result);
+            while (written < lengths[request])
+            {
+                const auto more = ::pwrite(destinations[request], buffer(request) + written,
+                                           lengths[request] - written, static_cast<off_t>(written));
+                if (more < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    fail(request, errno);
+                    return;
+                }
+                written += static_cast<size_type>(more);
+            }
+        });
+        record_round(PhaseTimings::Phase::Transfer);
+
+        if (interrupted())
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                fail(i, ECANCELED);
+            }
+        }
+
+        // Round four: close everything that was opened.  A failed close of a destination is a failed copy,
+        // since network file systems report deferred write errors there.
+        submitted = 0;
+        for (size_t i = 0; ring_ok && i < count; i++)
+        {
+            for (auto which : {source_tag, destination_tag})
+            {
+                const auto descriptor = which == source_tag ? sources[i] : destinations[i];
+                if (descriptor < 0)
+                {
+                    continue;
+                }
+                auto * close = ring.next_entry();
+                close->opcode = IORING_OP_CLOSE;
+                close->fd = descriptor;
+                close->user_data = tag(i, which);
+                submitted++;
+            }
+        }
+
+        ring_ok = ring_ok && ring.submit_and_wait(submitted, [&](uint64_t user_data, int result) {
+            const auto request = static_cast<size_t>(user_data >> 1);
+            if (result < 0 && (user_data & 1) == destination_tag)
+            {
+                fail(request, -result);
+            }
+            ((user_data & 1) == destination_tag ? destinations : sources)[request] = -1;
+        });
+        record_round(PhaseTimings::Phase::Close);
+
+        if (! ring_ok)
+        {
+            // The ring broke part way through.  Close what is still open and report the files as not copied.
+            for (size_t i = 0; i < count; i++)
+            {
+                for (auto descriptor : {sources[i], destinations[i]})
+                {
+                    if (descriptor >= 0)
+                    {
+                        ::close(descriptor);
+                    }
+                }
+                fail(i, EIO);
+            }
+            m_ring.reset();
+            return;
+        }
+
+        if (m_notifier)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                if (results[i] == 0)
+                {
+                    m_notifier(i, lengths[i]);
+                }
+            }
+        }
+    }
+
+#else
+
+    struct UringCopier::Ring
+    {};
+
+    UringCopier::UringCopier(size_type batch_size, size_type buffer_size) :
+        m_batch_size{batch_size}, m_buffer_size{buffer_size}, m_buffers{nullptr, std::free}
+    {}
+
+    UringCopier::~UringCopier() = default;
+
+    void UringCopier::copy(const std::vector<Request> & requests, std::vector<int> & results)
+    {
+        results.assign(requests.size(), ENOSYS);
+    }
+
+#endif
+
+} // namespace copy
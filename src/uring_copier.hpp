@@ -0,0 +1,171 @@
+/******************************************************************************
+ *
+ * Tectiform Open Source License (TOS)
+ *
+ * Copyright (c) 2022 to 2023 Tectiform Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *
+ * ******************************************************************************/
+
+#ifndef URING_COPIER_HPP
+#define URING_COPIER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "content_hash.hpp"
+#include "phase_timings.hpp"
+
+namespace copy
+{
+
+    /**
+     * @brief class that copies batches of small files through io_uring.
+     *
+     * A batch goes through the ring in four rounds: open every source and destination, read every
+     * file into its own registered buffer, write every buffer, and close every descriptor.  Each
+     * round is one io_uring_enter(2) call, however many files are in the batch.  A file has to fit
+     * in one buffer.  When a read fills the whole buffer the file gets file_too_large, and the
+     * caller copies it another way.
+     *
+     * With a hasher set, each buffer is hashed after the write round has been submitted, while the
+     * kernel works on the writes.
+     *
+     * The ring is set up through the raw system calls, so there is no liburing dependency.  Support
+     * is probed at runtime.  is_available() is false on kernels without io_uring or without the
+     * opcodes used here, and when a seccomp profile blocks the ring.  The caller then keeps using
+     * FileCopier.
+     */
+    class UringCopier
+    {
+    public:
+        using size_type = uint64_t;
+        using notifier_type = std::function<void(size_type request, size_type bytes)>;
+        using interrupter_type = std::function<bool()>;
+
+        struct Request
+        {
+            std::string source_path{};
+            std::string destination_path{};
+            uint32_t mode{0};
+        };
+
+        static constexpr int file_too_large{-1};
+
+        UringCopier(size_type batch_size, size_type buffer_size);
+
+        UringCopier(const UringCopier &) = delete;
+
+        UringCopier & operator=(const UringCopier &) = delete;
+
+        ~UringCopier();
+
+        [[nodiscard]] auto is_available() const -> bool
+        {
+            return m_ring != nullptr;
+        }
+
+        [[nodiscard]] auto batch_size() const -> size_type
+        {
+            return m_batch_size;
+        }
+
+        [[nodiscard]] auto buffer_size() const -> size_type
+        {
+            return m_buffer_size;
+        }
+
+        void set_notifier(notifier_type notifier)
+        {
+            m_notifier = std::move(notifier);
+        }
+
+        void set_interrupter(interrupter_type interrupter)
+        {
+            m_interrupter = std::move(interrupter);
+        }
+
+        /**
+         * @brief method to record how long each round takes in @e timings.  A round's time is shared
+         * evenly among the files in the batch.
+         */
+        void set_timings(PhaseTimings * timings)
+        {
+            m_timings = timings;
+        }
+
+        /**
+         * @brief method to hash every file copied with @e hasher, which must outlive this object.
+         * The digests are available from digests() after copy().
+         */
+        void set_hasher(ContentHasher * hasher)
+        {
+            m_hasher = hasher;
+        }
+
+        /**
+         * @return one digest per request of the last copy(), if a hasher is set.  Only the digests of
+         * successful requests are meaningful.
+         */
+        [[nodiscard]] auto digests() const -> const std::vector<ContentHasher::Digest> &
+        {
+            return m_digests;
+        }
+
+        /**
+         * @brief method to copy up to batch_size() files.
+         * @param requests the files to copy.
+         * @param results one result per request: 0 on success, file_too_large if the file did not fit
+         * in a buffer, otherwise the errno value of the failure.
+         */
+        void copy(const std::vector<Request> & requests, std::vector<int> & results);
+
+    private:
+        struct Ring;
+
+        size_type m_batch_size{0};
+        size_type m_buffer_size{0};
+        std::unique_ptr<Ring> m_ring{};
+        std::unique_ptr<char, void (*)(void *)> m_buffers;
+        bool m_fixed_buffers{false};
+
+        notifier_type m_notifier{};
+        interrupter_type m_interrupter{};
+        PhaseTimings * m_timings{nullptr};
+        ContentHasher * m_hasher{nullptr};
+        std::vector<ContentHasher::Digest> m_digests{};
+
+        [[nodiscard]] auto interrupted() const -> bool
+        {
+            return m_interrupter && m_interrupter();
+        }
+
+        [[nodiscard]] auto buffer(size_type index) const -> char *
+        {
+            return m_buffers.get() + index * m_buffer_size;
+        }
+    };
+
+} // namespace copy
+
+#endif // URING_COPIER_HPP
@@ -25,6 +25,7 @@
  *
  * ******************************************************************************/
 
+#include <cstdio>
 #include "utilities.hpp"
 
 namespace copy
@@ -164,4 +165,40 @@ namespace copy
         return format(seconds, divisor_and_label);
     }
 
+    void append_json_string(std::string & json, const std::string & value)
+    {
+        json.push_back('"');
+        for (const auto character : value)
+        {
+            switch (character)
+            {
+                case '"':
+                    json += "\\\"";
+                    break;
+                case '\\':
+                    json += "\\\\";
+                    break;
+                case '\n':
+                    json += "\\n";
+                    break;
+                case '\t':
+                    json += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(character) < 0x20)
+                    {
+                        char escaped[8]{};
+                        std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(character));
+                        json += escaped;
+                    }
+                    else
+                    {
+                        json.push_back(character);
+                    }
+                    break;
+            }
+        }
+        json.push_back('"');
+    }
+
 } // namespace copy
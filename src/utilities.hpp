@@ -28,6 +28,7 @@
 #ifndef UTILITIES_HPP
 #define UTILITIES_HPP
 
+#include <string>
 #include "TFFoundation.hpp"
 
 using namespace TF::Foundation;
@@ -50,6 +51,14 @@ namespace copy
      */
     auto format_seconds(double seconds) -> String;
 
+    /**
+     * @brief function to append @e value to @e json as a quoted JSON string, with quotes,
+     * backslashes and control characters escaped.
+     * @param json the JSON text to append to.
+     * @param value the string to quote.
+     */
+    void append_json_string(std::string & json, const std::string & value);
+
 } // namespace copy
 
 #endif // UTILITIES_HPP
@@ -0,0 +1,120 @@
+/******************************************************************************
+*
+* Tectiform Open Source License (TOS)
+*
+* Copyright (c) 2022 to 2022 Tectiform Inc.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+*
+* ******************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "duplicate_finder.hpp"
+#include "file_inventory.hpp"
+
+using namespace copy;
+
+namespace
+{
+    int failures{0};
+
+    void check(bool condition, const char * message)
+    {
+        if (! condition)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", message);
+            failures++;
+        }
+    }
+
+    void write_file(const std::string & path, const std::string & contents)
+    {
+        std::ofstream file{path, std::ios::binary};
+        file << contents;
+    }
+
+    auto find_duplicates(const std::string & root, const std::vector<std::string> & names,
+                         std::vector<FileInventory::Identity> & identities) -> DuplicateFinder::result_type
+    {
+        FileInventory inventory{};
+        for (const auto & name : names)
+        {
+            const auto entry = inventory.add_item_at_path(root + "/" + name, root.size() + 1);
+            identities.push_back(entry ? FileInventory::identity_of(*entry) : FileInventory::Identity{});
+        }
+        inventory.mark_complete();
+
+        DuplicateFinder finder{ContentHasher::Algorithm::XXH3, 2};
+        return finder.find(inventory, root);
+    }
+} // namespace
+
+auto main() -> int
+{
+    char root_template[]{"/tmp/duplicate_finder_test.XXXXXX"};
+    const auto * root_path = ::mkdtemp(root_template);
+    if (root_path == nullptr)
+    {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    const std::string root{root_path};
+
+    // Same size, so only the contents can tell the files apart.
+    const std::string contents(DuplicateFinder::smallest_candidate * 2, 'a');
+    auto different = contents;
+    different.back() = 'b';
+    write_file(root + "/first", contents);
+    write_file(root + "/copy", contents);
+    write_file(root + "/different", different);
+
+    std::vector<FileInventory::Identity> identities{};
+    const auto duplicates = find_duplicates(root, {"first", "copy", "different"}, identities);
+
+    check(duplicates.size() == 2, "only the two identical files are grouped");
+    check(duplicates.contains(identities[0]) && duplicates.at(identities[0]) == identities[0],
+          "the first file of the group maps to itself");
+    check(duplicates.contains(identities[1]) && duplicates.at(identities[1]) == identities[0],
+          "the identical file maps to the first file");
+    check(! duplicates.contains(identities[2]), "a file of the same size with other contents is not grouped");
+
+    // Two files that share nothing but their size.
+    identities.clear();
+    const auto pair = find_duplicates(root, {"different", "first"}, identities);
+    check(pair.empty(), "two same-size files with different contents are not grouped");
+
+    for (const auto * name : {"first", "copy", "different"})
+    {
+        ::unlink((root + "/" + name).c_str());
+    }
+    ::rmdir(root.c_str());
+
+    if (failures > 0)
+    {
+        return 1;
+    }
+    std::printf("duplicate_finder_test passed\n");
+    return 0;
+}